@@ -13,6 +13,8 @@ CFLAGS += -mcmodel=medany
 CFLAGS += -ffreestanding -fno-common -nostdlib -mno-relax
 CFLAGS += -I.
 # CFLAGS += -D FS_FAT32
+# CFLAGS += -D VIO_NO_EVENT_IDX   # 编译时选择: 不协商virtio-blk的EVENT_IDX (每个请求都通知/中断)
+# CFLAGS += -D VIO_POLL           # 编译时选择: 短的同步磁盘请求先轮询完成
 CFLAGS += $(shell $(CC) -fno-stack-protector -E -x c /dev/null >/dev/null 2>&1 && echo -fno-stack-protector)
 # Disable PIE when possible (for Ubuntu 16.10 toolchain)
 ifneq ($(shell $(CC) -dumpspecs 2>/dev/null | grep -e '[^f]no-pie'),)
@@ -38,7 +38,7 @@ typedef enum {false = 0, true = 1} bool;
 #define EXT4_NAME_LEN 255         // 文件名最大长度
 #define NGROUP 32                 // group_desc数量
 
-#define NBUF   30                 // buf的最大数量(一个buf对应一个block)          
+#define NBUF   30                 // buf的最大数量(一个buf最多对应一个block)          
 #define NINODE 50                 // inode的最大数量(一个inode对应一个文件)
 #define NDEV   10                 // 设备的最大数量
 #define NFILE  256                // 整个系统同时打开的最大文件数量
@@ -3,8 +3,39 @@
 
 typedef struct buf buf_t;
 
+#define VIO_SEG_MAX 16   // 一个请求最多覆盖的buf数量(scatter-gather)
+#define VIO_POLL_NSEC 8  // 不超过这么多扇区的同步请求可以轮询完成
+#define VIO_POLL_USEC 50 // 轮询的时间上限, 超时后转为睡眠等待中断
+
+// 直接I/O的一个内存段 (物理地址连续)
+typedef struct vio_seg {
+    uint64 addr;  // 物理地址
+    uint32 len;   // 字节数 (SECTOR_SIZE的倍数)
+} vio_seg_t;
+
+// 完成统计 (延迟的单位是时钟滴答)
+typedef struct vio_stat {
+    bool   event_idx;     // 是否协商了VIRTIO_RING_F_EVENT_IDX
+    bool   poll;          // 是否打开了轮询模式
+    int    nqueue;        // 虚拟队列数 (VIRTIO_BLK_F_MQ)
+    uint64 nintr;         // 磁盘中断次数
+    uint64 nnotify;       // 通知设备的次数
+    uint64 nsuppress;     // 设备表示不需要而省掉的通知次数
+    uint64 nreq_intr;     // 在中断中完成的请求数
+    uint64 nreq_poll;     // 在轮询中完成的请求数
+    uint64 npoll_miss;    // 轮询超时转为睡眠的次数
+    uint64 lat_intr;      // 中断完成的请求的总延迟
+    uint64 lat_poll;      // 轮询完成的请求的总延迟
+    uint64 lat_max;       // 最大延迟
+} vio_stat_t;
+
 void virtio_disk_init(void);                         // VIO初始化
-void virtio_disk_rw(buf_t* buf, bool write);         // 对磁盘的读写操作
+void virtio_disk_rw(buf_t* buf, bool write);         // 对磁盘的读写操作(同步)
+void virtio_disk_submit(buf_t* buf, bool write, void (*done)(buf_t*)); // 提交请求(异步)
+void virtio_disk_submit_vec(buf_t** bufs, int n, bool write, void (*done)(buf_t*)); // 多个连续buf
+void virtio_disk_wait(buf_t* buf);                   // 等待请求完成
+void virtio_disk_rw_direct(uint64 sector, vio_seg_t* segs, int n, bool write); // 直接I/O(同步)
 void virtio_disk_intr();                             // VIO中断处理
+void virtio_disk_stat(vio_stat_t* st);               // 读取完成统计
 
 #endif
\ No newline at end of file
@@ -39,7 +39,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -53,11 +53,12 @@ struct virtq_desc {
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
-	uint16 flags;	  // always zero
+	uint16 flags;	  // VRING_AVAIL_F_NO_INTERRUPT or zero
 	uint16 idx;	  // driver will write ring[idx] next
 	uint16 ring[NUM]; // descriptor numbers of chain heads
-	uint16 unused;
+	uint16 used_event; // only if VIRTIO_RING_F_EVENT_IDX
 };
+#define VRING_AVAIL_F_NO_INTERRUPT 1 // hint: don't interrupt when consuming
 
 // one entry in the "used" ring, with which the
 // device tells the driver about completed requests.
@@ -67,11 +68,17 @@ struct virtq_used_elem {
 };
 
 struct virtq_used {
-	uint16 flags; // always zero
+	uint16 flags; // VRING_USED_F_NO_NOTIFY or zero
 	uint16 idx;   // device increments when it adds a ring[] entry
 	struct virtq_used_elem ring[NUM];
-	uint16 unused;
+	uint16 avail_event; // only if VIRTIO_RING_F_EVENT_IDX
 };
+#define VRING_USED_F_NO_NOTIFY 1 // hint: don't kick when adding a buffer
+
+// with VIRTIO_RING_F_EVENT_IDX: does moving idx from old to new
+// pass the event index the other side asked to be notified at?
+#define vring_need_event(event, new, old) \
+	((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
 
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
@@ -0,0 +1,17 @@
+#ifndef __BIO_H__
+#define __BIO_H__
+
+#include "common.h"
+
+typedef struct buf buf_t;
+
+#define BIO_BATCH 32   // 排队请求达到这个数量时即使处于plug状态也立即下发
+
+void bio_init(void);                                       // 初始化
+void bio_submit(buf_t* buf, bool write, void (*done)(buf_t*)); // 提交请求(进入调度队列)
+void bio_wait(buf_t* buf);                                 // 等待请求完成
+void bio_kick(void);                                       // 立即下发队列
+void bio_plug(void);                                       // 当前进程开始攒批
+void bio_unplug(void);                                     // 结束攒批, 下发队列
+
+#endif
\ No newline at end of file
@@ -7,20 +7,57 @@ typedef struct buf {
     
     bool valid;              // 这个buf是否有效
     bool disk;               // virtio_disk中使用
+    int vq;                  // 请求所在的virtio队列, -1表示还没有提交到设备
+    bool dirty;              // 被修改过但还没有写回磁盘
+    uint64 dirty_tick;       // 变为dirty时的ticks
     uint32 dev;              // 设备号
-    uint32 ref;              // 引用数
+    uint32 ref;              // 引用数(受所在哈希桶的锁保护)
 
-    uint32 sector;           // 对应的扇区序号
-    uint8 data[SECTOR_SIZE]; // sector的数据放在这里
+    uint32 sector;           // 对应的起始扇区序号
+    uint32 nsec;             // 覆盖的连续扇区数(1 ~ SEC_PER_BLO)
+    uint8 data[BLOCK_SIZE];  // [sector, sector+nsec)的数据放在这里
 
-    struct buf *prev, *next; // 双向循环链表,用于LRU支持
-    sleeplock_t lk;          // 睡眠锁
+    struct buf *prev, *next;   // 双向链表,用于LRU支持(只链接ref=0的buf)
+    struct buf *hprev, *hnext; // 双向链表,用于哈希桶
+    struct buf *qnext;         // 单向链表,用于bio调度队列
+    bool qwrite;               // bio请求的方向
+    void (*qdone)(struct buf*); // bio请求的完成回调
+    sleeplock_t lk;            // 睡眠锁
 
 } buf_t;
 
+#define RA_MAX 8  // 预读窗口的最大值, 也是一次预读的单元数上限(约为NBUF的1/4, 防止预读冲掉整个缓存)
+
+// 顺序预读窗口 (每个打开的文件一个)
+typedef struct ra_state {
+    uint32 next_off;         // 顺序访问时下一次读取的偏移量
+    uint32 win;              // 预读窗口大小(单位由调用者决定: block或簇)
+    uint32 ra_end;           // 已经发起预读的文件偏移量上界
+} ra_state_t;
+
+// 缓存的统计信息
+typedef struct buf_stat {
+    uint32 nbuf;             // buf总数(NBUF)
+    uint32 nvalid;           // 有效的buf数
+    uint64 nbytes;           // 有效buf中缓存的字节数
+    uint32 ndirty;           // dirty buf数
+    uint32 nwriteback;       // 正在回写的buf数
+} buf_stat_t;
+
 void   buf_init(void);                         // 初始化
-buf_t* buf_read(uint32 dev, uint32 sector);    // 基于buf的读操作
-void   buf_write(buf_t* buf);                  // 基于buf的写操作
+void   buf_flusher_init(void);                 // 启动后台回写线程
+buf_t* buf_read(uint32 dev, uint32 sector);    // 基于buf的读操作(单个扇区)
+buf_t* buf_read_nsec(uint32 dev, uint32 sector, uint32 nsec); // 读连续nsec个扇区
+void   buf_write(buf_t* buf);                  // 基于buf的写操作(延迟写回)
+void   buf_sync(void);                         // 写回所有dirty buf
+void   buf_sync_range(uint32 dev, uint32 sector, uint32 nsec, bool drop); // 直接I/O前同步缓存
 void   buf_release(buf_t* buf);                // 释放buf
+void   buf_prefetch(uint32 dev, uint32 sector, uint32 nsec); // 预读(不返回buf)
+void   buf_prefetch_run(uint32 dev, uint32 sector, uint32 nsec, uint32 count); // 预读连续count个单元
+
+void   buf_stat(buf_stat_t* st);                // 统计信息
+
+void   buf_ra_reset(ra_state_t* ra);           // 预读窗口复位
+uint32 buf_ra_update(ra_state_t* ra, uint32 off, uint32 len, uint32 unit, uint32* ra_off); // 计算预读区间
 
 #endif
\ No newline at end of file
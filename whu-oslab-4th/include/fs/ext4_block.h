@@ -2,7 +2,9 @@
 #define __EXT4_BLOCK_H__
 
 #include "common.h"
+#include "fs/base_buf.h"
 
+buf_t* ext4_block_buf(uint32 dev, uint32 block_num);
 uint32 ext4_block_read(uint32 dev, uint32 block_num, uint32 off, uint32 len, void* dst, bool user_dst);
 uint32 ext4_block_write(uint32 dev, uint32 block_num, uint32 off, uint32 len, void* src, bool user_src);
 uint32 ext4_block_alloc(uint32 dev);
@@ -2,6 +2,7 @@
 #define __EXT4_FILE_H__
 
 #include "lock/lock.h"
+#include "fs/base_buf.h"
 
 typedef struct ext4_dirent ext4_dirent_t;
 typedef struct ext4_inode ext4_inode_t;
@@ -13,6 +14,7 @@ typedef struct ext4_pipe  ext4_pipe_t;
 #define FLAGS_RDWR     0x002          // 读写
 #define FLAGS_CREATE   0x040          // 创建新的文件
 #define FLAGS_APPEND   0x2000         // 追加写
+#define FLAGS_DIRECT   0x4000         // 直接I/O, 不经过buf缓存 (O_DIRECT)
 #define FLAGS_CLOEXEC  0x80000        //
 
 // 文件抽象
@@ -28,6 +30,7 @@ typedef struct ext4_file {
     uint16 major;        // 主设备号 辅助字符设备文件
     ext4_pipe_t* pipe;   // pipe 辅助FIFO文件
     spinlock_t  lk;      // 自旋锁
+    ra_state_t  ra;      // 顺序预读窗口 辅助常规文件
 
     uint64 flags_low;
     uint64 flags_high;
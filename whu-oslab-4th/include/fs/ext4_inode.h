@@ -63,6 +63,8 @@ typedef struct ext4_inode {
     uint32 nlink;                   // 链接数
     uint64 size;                    // 文件大小(byte)
     ext4_extent_node_t node;        // 管理的blocks信息
+	/* 页缓存 (文件mmap) */
+	struct ext4_page* pages;        // 缓存的页 (ext4_pcache.c)
 } ext4_inode_t;
 
 
@@ -86,7 +88,9 @@ void          ext4_inode_unlockput(ext4_inode_t* ip);
 
 void          ext4_inode_trunc(ext4_inode_t* ip);
 uint32        ext4_inode_read(ext4_inode_t* ip, uint32 off, uint32 len, void* dst, bool user_dst);
+void          ext4_inode_readahead(ext4_inode_t* ip, uint32 off, uint32 len);
 uint32        ext4_inode_write(ext4_inode_t* ip, uint32 off, uint32 len, void* src, bool user_src);
+uint32        ext4_inode_direct(ext4_inode_t* ip, uint32 off, uint32 len, uint64 uaddr, bool write);
 
 
 uint8         mode_to_type(uint16 mode);
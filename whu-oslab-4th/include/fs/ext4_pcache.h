@@ -0,0 +1,40 @@
+#ifndef __EXT4_PCACHE_H__
+#define __EXT4_PCACHE_H__
+
+#include "common.h"
+
+#define EXT4_PCACHE_NHASH 256   // 哈希桶数
+#define EXT4_PCACHE_MAX   2048  // 缓存页数的软上限, 超过时回收没有被映射的干净页
+
+typedef struct ext4_inode ext4_inode_t;
+
+// 页缓存中的一个4K页 (文件mmap使用)
+typedef struct ext4_page {
+    ext4_inode_t* ip;                        // 所属inode
+    uint32 index;                            // 文件中的第几个4K页
+    uint64 pa;                               // 物理页
+    bool dirty;                              // 需要写回
+    struct ext4_page* hnext;                 // 哈希链
+    struct ext4_page *inext, *iprev;         // inode的页链表
+    struct ext4_page *lru_next, *lru_prev;   // LRU双向循环链表
+} ext4_page_t;
+
+// 页缓存统计信息
+typedef struct pcache_stat {
+    uint32 npages;      // 缓存的页数
+    uint32 ndirty;      // 脏页数
+    uint64 nhit;        // 命中次数
+    uint64 nmiss;       // 从文件读入的次数
+    uint64 nevict;      // 回收的页数
+    uint64 nwriteback;  // 写回的页数
+} pcache_stat_t;
+
+void   ext4_pcache_init(void);
+uint64 ext4_pcache_get(ext4_inode_t* ip, uint32 index, bool* major);
+void   ext4_pcache_dirty(ext4_inode_t* ip, uint32 index);
+void   ext4_pcache_writeback(ext4_inode_t* ip, uint32 first, uint32 last);
+void   ext4_pcache_refresh(ext4_inode_t* ip, uint32 off, uint32 len);
+void   ext4_pcache_drop(ext4_inode_t* ip);
+void   ext4_pcache_stat(pcache_stat_t* st);
+
+#endif
@@ -16,6 +16,8 @@ typedef struct ext4_pipe {
 
 typedef struct ext4_file ext4_file_t;
 
+void ext4_pipe_init();
+uint32 ext4_pipe_count(void);
 int  ext4_pipe_alloc(ext4_file_t** read, ext4_file_t** write);
 void ext4_pipe_close(ext4_pipe_t* pi, bool write_port);
 int  ext4_pipe_read(ext4_pipe_t* pi, uint64 dst, uint32 n, bool user_dst);
@@ -232,7 +232,7 @@ struct ext4_raw_inode {
 	uint32 i_unused[24];              /* 未使用 */
 }__attribute__((packed));
 
-#define INODE_PER_SEC (SECTOR_SIZE / sizeof(struct ext4_raw_inode))
+#define INODE_PER_BLO (BLOCK_SIZE / sizeof(struct ext4_raw_inode))
 
 /*
 	i_mode:
@@ -16,6 +16,7 @@ void   fat32_cluster_clear(uint32 dev, uint32 cluster);
 
 // 读写cluster
 
+void   fat32_cluster_prefetch(uint32 dev, uint32 cluster);
 uint32 fat32_cluster_read (uint32 dev, uint32 cluster, uint32 offset, uint32 len, uint64 dst, bool user_dst);
 uint32 fat32_cluster_write(uint32 dev, uint32 cluster, uint32 offset, uint32 len, uint64 src, bool user_src);
 
@@ -3,6 +3,7 @@
 
 #include "fs/fat32_inode.h"
 #include "fs/fat32_pipe.h"
+#include "fs/base_buf.h"
 
 // 文件
 typedef enum {
@@ -21,6 +22,7 @@ typedef struct fat32_file {
     int16 major;          // DEVICE
     uint32 off;           // INODE
     fat32_inode_t* ip;    // INODE
+    ra_state_t ra;        // INODE 顺序预读窗口
 } fat32_file_t;
 
 /* --------------------关于设备文件-------------------- */
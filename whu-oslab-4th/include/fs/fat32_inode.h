@@ -65,6 +65,7 @@ typedef struct {
 void     fat32_inode_init(uint32 dev);
 uint32   fat32_inode_relocate(fat32_inode_t* ip, uint32 off, bool alloc);
 int      fat32_inode_read(fat32_inode_t* ip, uint32 off, uint32 len, uint64 dst, bool user_dst);
+void     fat32_inode_readahead(fat32_inode_t* ip, uint32 off, uint32 len);
 int      fat32_inode_write(fat32_inode_t* ip, uint32 off, uint32 len, uint64 src, bool user_src);
 void     fat32_inode_lock(fat32_inode_t* ip);
 void     fat32_inode_unlock(fat32_inode_t* ip);
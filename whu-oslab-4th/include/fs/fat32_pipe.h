@@ -16,6 +16,8 @@ typedef struct pipe {
 
 typedef struct fat32_file fat32_file_t;
 
+void fat32_pipe_init(void);
+uint32 fat32_pipe_count(void);
 int  fat32_pipe_alloc(fat32_file_t** read, fat32_file_t** write);
 void fat32_pipe_close(pipe_t* pi, bool writeable);
 int  fat32_pipe_write(pipe_t* pi, uint64 va, int n);
@@ -8,6 +8,14 @@
 typedef enum {
     VNODE_PROC_MEMINFO,
     VNODE_PROC_MOUNTS,
+    VNODE_PROC_VIRTIO_BLK,
+    VNODE_PROC_BUDDYINFO,
+    VNODE_PROC_ZONEINFO,
+    VNODE_PROC_UNUSABLE_INDEX,
+    VNODE_PROC_SLABINFO,
+    VNODE_PROC_PAGETYPEINFO,
+    VNODE_PROC_VMSTAT,
+    VNODE_PROC_SELF_FAULTS,
     VNODE_ETC_LOCALTIME,
     VNODE_ETC_ADJTIME,
     VNODE_ETC_PASSWD,
@@ -6,12 +6,40 @@
 // 来自 mem.S 和 pmem.c
 extern uint64 KERNEL_TEXT;
 extern uint64 KERNEL_DATA;
-extern uint64 USER_BASE;
 extern uint64 USER_END;
 
+#define PMEM_MAX_ORDER 10 // 伙伴系统最大的块: 2^10个页 (4MB)
+
+// 伙伴系统的统计信息
+typedef struct pmem_stat {
+    uint64 total;                       // 总页数
+    uint64 free;                        // 空闲页数
+    uint64 nkernel;                     // 内核申请走的页数
+    uint64 nuser;                       // 用户申请走的页数
+    uint32 nblock[PMEM_MAX_ORDER + 1];  // 各阶空闲块的数量
+    uint64 wmark_min;                   // 水位线: 内核保留
+    uint64 wmark_low;                   // 水位线: hart缓存不再留页
+    uint64 wmark_high;                  // 水位线: 停止补充清零池
+    uint64 nfail;                       // 因内核保留被拒绝的用户申请次数
+    uint64 cached;                      // 各hart单页缓存中的页数 (不计入free)
+    uint64 nalloc;                      // 单页申请次数
+    uint64 nhit;                        // 其中直接命中hart缓存的次数
+    uint64 nrefill;                     // 缓存批量补充次数
+    uint64 ndrain;                      // 缓存批量归还次数
+    uint64 zeroed;                      // 清零池中的页数 (不计入free)
+    uint64 zhit;                        // pmem_alloc_zeroed命中清零池的次数
+    uint64 zmiss;                       // pmem_alloc_zeroed当场清零的次数
+} pmem_stat_t;
 
 void  pmem_init(bool output);                                    // 物理内存初始化
 void* pmem_alloc_pages(int npages, bool in_kernel);              // 物理页申请
+void* pmem_alloc_zeroed(bool in_kernel);                         // 申请一个全0的物理页
+void  pmem_zeroer_init(void);                                    // 启动后台清零线程
 void  pmem_free_pages(void* ptr, int npages, bool in_kernel);    // 物理页释放
+void  pmem_dup_pages(void* ptr, int npages);                     // 写时复制: 页多了一个共享者
+bool  pmem_shared(void* ptr, int npages);                        // 页是否被共享
+void* pmem_block_head(void* ptr, int npages);                    // ptr所在块的起始地址
+void  pmem_stat(pmem_stat_t* st);                                // 统计信息
+uint32 pmem_frag_index(pmem_stat_t* st, int order);              // order阶的碎片化指数(千分比)
 
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "common.h"
+#include "lock/lock.h"
+
+#define SLAB_NCACHE    16  // kmem_cache的最大数量
+#define SLAB_MAX_ORDER 3   // 一个slab最多占2^3个页
+#define SLAB_MIN_OBJS  8   // 一个slab至少容纳的对象数(对象太大时除外)
+#define SLAB_CPU_MAX   16  // 每个hart缓存的对象数上限
+#define SLAB_BATCH     8   // 一次和slab交换的对象数
+
+typedef struct kmem_cache kmem_cache_t;
+
+// 一个slab: 2^order个连续的内核页, 开头是这个结构体, 后面是对象
+typedef struct slab {
+    struct slab* next;      // 所在链表(partial/full/free)
+    struct slab* prev;
+    kmem_cache_t* cache;    // 所属的cache
+    void* freelist;         // 空闲对象链表(对象的前8字节存放next)
+    uint32 inuse;           // 已分配的对象数(包括在hart缓存中的)
+} slab_t;
+
+// 每个hart的对象缓存
+typedef struct slab_cpu {
+    void* obj[SLAB_CPU_MAX];
+    int count;
+    spinlock_t lk;          // 只有所属的hart使用
+} slab_cpu_t;
+
+// 一种固定大小对象的cache
+struct kmem_cache {
+    char name[16];          // 名字(用于/proc/slabinfo)
+    uint32 size;            // 对象大小(8字节对齐)
+    uint32 order;           // 每个slab占2^order个页
+    uint32 nper;            // 每个slab的对象数
+
+    slab_t partial;         // 部分使用的slab (双向循环链表的哨兵)
+    slab_t full;            // 全部使用的slab
+    slab_t free;            // 全部空闲的slab (最多保留一个)
+    uint32 nslab;           // slab总数
+    uint32 nactive;         // 已分配给调用者的对象数
+
+    uint64 nalloc;          // 申请次数
+    uint64 nhit;            // 直接命中hart缓存的次数
+
+    slab_cpu_t cpu[NCPU];   // 每个hart的对象缓存
+    spinlock_t lk;          // 保护slab链表
+};
+
+// slab统计信息
+typedef struct slab_stat {
+    char name[16];
+    uint32 size;
+    uint32 order;
+    uint32 nper;
+    uint32 nslab;
+    uint32 nactive;
+    uint64 nalloc;
+    uint64 nhit;
+} slab_stat_t;
+
+kmem_cache_t* kmem_cache_create(char* name, uint32 size);      // 创建cache
+void*         kmem_cache_alloc(kmem_cache_t* cache);            // 申请对象(内容任意), 失败返回NULL
+void*         kmem_cache_zalloc(kmem_cache_t* cache);           // 申请对象并清零
+void          kmem_cache_free(kmem_cache_t* cache, void* obj);  // 释放对象
+uint32        kmem_cache_inuse(kmem_cache_t* cache);            // 已分配给调用者的对象数
+int           kmem_cache_stat(int i, slab_stat_t* st);          // 第i个cache的统计, 不存在返回-1
+uint64        kmem_cache_pages(void);                           // 所有slab占用的物理页数
+
+#endif
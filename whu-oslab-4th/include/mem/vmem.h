@@ -37,12 +37,21 @@ typedef uint64* pgtbl_t;
 
 // satp寄存器相关
 #define SATP_SV39 (8L << 60)  // MODE = SV39
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12)) // 设置MODE和PPN字段
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xFFFFul
+#define SATP_ASID(satp) (((satp) >> SATP_ASID_SHIFT) & SATP_ASID_MASK)
+#define MAKE_SATP(pagetable, asid) (SATP_SV39 | (((uint64)(asid) & SATP_ASID_MASK) << SATP_ASID_SHIFT) | \
+                                    (((uint64)pagetable) >> 12)) // 设置MODE, ASID和PPN字段
 
 // 获取虚拟地址中的虚拟页(VPN)信息 占9bit
 #define VA_SHIFT(level)         (PAGE_OFFSET + 9 * (level))
 #define VA_TO_VPN(va,level)     ((((uint64)(va)) >> VA_SHIFT(level)) & 0x1FF)
 
+// 第level级PTE覆盖的地址范围: 0级4K, 1级2M, 2级1G
+#define VM_LEVEL_SIZE(level)    (1ul << VA_SHIFT(level))
+#define VM_MEGA_SIZE            VM_LEVEL_SIZE(1)
+#define VM_MEGA_NPAGES          (VM_MEGA_SIZE / PAGE_SIZE)  // 一个2M大页包含的4K页数
+
 // PA和PTE之间的转换
 #define PA_TO_PTE(pa) ((((uint64)(pa)) >> 12) << 10)
 #define PTE_TO_PA(pte) (((pte) >> 10) << 12)
@@ -61,23 +70,33 @@ typedef uint64* pgtbl_t;
 #define PTE_SHA (1 << 9) // 共享页面
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)  // 获取低10bit的flag信息
+#define PTE_IS_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X)) // 叶子PTE(指向数据页而不是下一级页表)
 
 
-// mmap映射的region
+// mmap映射的region, 每个进程的region组成一棵按start排序的AVL树
 typedef struct vm_region {
     uint64 start;           // 一个page的起始虚拟地址
     int npages;             // region 大小
     int flags;              // region flags
-    struct vm_region* next; // 用于构造链表
+    int perm;               // 页面权限(PTE_R/W/X/U), 按需分配时使用, PROT_NONE为0
+    struct ext4_inode* ip;  // 文件映射的inode (持有一次引用), 匿名映射为NULL
+    uint64 off;             // 文件映射: start对应的文件偏移 (page-aligned)
+    struct vm_region *left, *right; // AVL树的左右孩子
+    int height;             // 子树高度
+    uint64 lo, hi;          // 子树覆盖的范围[lo, hi)
+    uint64 maxgap;          // 子树内相邻region之间最大的空洞
 } vm_region_t;
 
+#define VM_REGION_END(r) ((r)->start + (uint64)(r)->npages * PAGE_SIZE)
+
 /*
     注意: 
     kvm开头函数的只有内核使用 
     uvm开头函数的只有用户使用 
     vm开头函数的两边都可以使用
     kvm 和 vm 实现于 kvm.c
-    uvm 实现于 uvm.c
+    uvm 实现于 uvm.c, 其中mmap区域树实现于 region.c
+    ASID和TLB刷新实现于 asid.c
 */
 
 // 初始化
@@ -89,12 +108,15 @@ void  kvm_inithart(void);
 
 pgtbl_t uvm_alloc_pagetable(void);
 void    uvm_free_pagetable(pgtbl_t pagetable);
-void    uvm_free(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_head); // 页表和data page都释放
-int     uvm_copy_pagetable(pgtbl_t old, pgtbl_t new, uint64 sz, vm_region_t* head);
+void    uvm_free(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_root); // 页表和data page都释放
+int     uvm_copy_pagetable(pgtbl_t old, pgtbl_t new, uint64 sz, vm_region_t* vm_root);
+void    uvm_uncopy_pagetable(pgtbl_t new, uint64 sz, vm_region_t* vm_root);
 
 // 页面建立映射、解除映射、权限控制
 
 int   vm_mappages(pgtbl_t pagetable, uint64 va, uint64 pa, uint64 len, int perm);
+int   vm_map_mega(pgtbl_t pagetable, uint64 va, uint64 pa, int perm);
+int   uvm_split_mega(pgtbl_t pagetable, uint64 va);
 void  uvm_unmappages(pgtbl_t pagetable, uint64 va, uint64 npages, bool freeit);
 uint64 uvm_protect(uint64 start, int len, int prot);
 
@@ -109,17 +131,118 @@ int  uvm_copyin2(pgtbl_t pagetable, char* dst, uint64 srcva, uint64 maxlen);
 // 用户地址空间的扩大与缩小
 
 uint64  uvm_grow(pgtbl_t pagetable, uint64 oldsz, uint64 newsz, int xperm);
+uint64  uvm_grow_lazy(uint64 oldsz, uint64 newsz);
 uint64  uvm_ungrow(pgtbl_t pagetable, uint64 oldsz, uint64 newsz);
 uint64  uvm_mmap(uint64 start, int len, int prot, int flags, int fd, int off);
-uint64  uvm_munmap(uint64 start, int len);
+uint64  uvm_munmap(uint64 start, uint64 len);
+uint64  uvm_msync(uint64 start, int len);
+void    uvm_free_regions(pgtbl_t pagetable, vm_region_t* root);
+
+// 透明大页的统计信息
+typedef struct thp_stat {
+    uint64 nr_huge;          // 当前映射着的2M大页数
+    uint64 nalloc;           // 成功使用大页的次数
+    uint64 nfallback;        // 没有连续物理内存, 退回4K页的次数
+    uint64 nsplit;           // 大页被拆成4K页的次数
+} thp_stat_t;
+
+void  uvm_thp_stat(thp_stat_t* st);
+
+// 写时复制的统计信息
+typedef struct cow_stat {
+    uint64 nshare;           // fork时共享的4K页数
+    uint64 ncopy;            // 写时复制缺页中复制了页的次数
+    uint64 nreuse;           // 写时复制缺页中页已不再共享, 直接恢复可写的次数
+} cow_stat_t;
+
+int   uvm_cow_fault(pgtbl_t pagetable, uint64 va);
+void  uvm_cow_stat(cow_stat_t* st);
+
+// 按需分配的统计信息
+typedef struct lazy_stat {
+    uint64 nreserve;         // brk和匿名mmap保留的4K页数
+    uint64 nzero;            // 读缺页映射零页的次数
+    uint64 nalloc;           // 写缺页分配的4K页数(大页按512计)
+    uint64 nminor;           // 不需要I/O的缺页次数
+    uint64 nmajor;           // 需要读文件的缺页次数
+} lazy_stat_t;
+
+void  uvm_lazy_stat(lazy_stat_t* st);
+
+// ASID: 进程的p->asid = 代 << ASID_GEN_SHIFT | ASID (0表示还没有分配), 内核页表使用ASID 0
+#define ASID_GEN_SHIFT 16
+
+typedef struct asid_stat {
+    uint64 nasid;            // 硬件支持的ASID数 (不支持时为0)
+    uint64 generation;       // 当前代
+    uint64 nalloc;           // 分配ASID的次数
+    uint64 nrollover;        // ASID用完换代的次数
+    uint64 nflush_asid;      // 只刷新一个ASID(或其中一页)的次数
+    uint64 nflush_all;       // 刷新整个TLB的次数
+} asid_stat_t;
+
+struct proc;
+
+void   vm_asid_init(void);
+void   vm_asid_inithart(void);
+uint64 uvm_satp(struct proc* p);
+void   vm_flush_tlb(pgtbl_t pagetable);
+void   vm_flush_page(pgtbl_t pagetable, uint64 va);
+void   vm_asid_stat(asid_stat_t* st);
+
+// 缺页处理时va所在区域的类型
+typedef enum {
+    VM_AREA_NONE,            // 不属于任何区域
+    VM_AREA_IMAGE,           // 程序映像, exec时全部映射
+    VM_AREA_GUARD,           // 用户栈下面的保护页
+    VM_AREA_STACK,           // 用户栈
+    VM_AREA_ANON,            // brk堆和匿名mmap
+    VM_AREA_FILE,            // 文件mmap
+} vm_area_type_t;
+
+typedef struct vm_area {
+    vm_area_type_t type;
+    uint64 start;            // [start, end)
+    uint64 end;
+    int perm;                // 页面权限(PTE_R/W/X/U)
+    vm_region_t* region;     // mmap区域 (其他类型为NULL)
+} vm_area_t;
+
+#define VM_FAULT_MINOR 0     // 缺页处理没有读文件
+#define VM_FAULT_MAJOR 1     // 缺页处理读了文件
+
+int   uvm_fault(uint64 va, int access);
+
+// 页表范围遍历的回调: 对每个有效的叶子PTE调用, va是叶子中第一个落在范围内的地址
+// 可以修改或清空PTE, 也可以把大页拆成下一级页表(遍历接着进入它), 返回负数停止遍历
+typedef int (*vm_leaf_fn_t)(pte_t* pte, uint64 va, int level, void* arg);
 
 // 虚拟内存模块的辅助函数
 
 pte_t*       vm_getpte(pgtbl_t pagetable, uint64 va, bool alloc);
+pte_t*       vm_getleaf(pgtbl_t pagetable, uint64 va, int* level);
+pgtbl_t      vm_leaf_table(pgtbl_t pagetable, uint64 va, bool alloc);
+int          vm_walk_range(pgtbl_t pagetable, uint64 va, uint64 end, bool prune, vm_leaf_fn_t fn, void* arg);
+pgtbl_t      vm_pgtbl_alloc(void);
+void         vm_pgtbl_free(pgtbl_t pagetable);
+uint64       vm_pgtbl_pages(void);
 uint64       uvm_getpa(pgtbl_t pagetable, uint64 va);
-vm_region_t* uvm_region_alloc();
 void         uvm_region_free(pgtbl_t pagetable ,vm_region_t* region);
 
+// mmap区域树 (region.c)
+
+void         uvm_region_init(void);
+vm_region_t* uvm_region_alloc();
+void         uvm_region_put(vm_region_t* region);
+vm_region_t* uvm_region_copy(vm_region_t* root);
+vm_region_t* uvm_region_find(vm_region_t* root, uint64 va);
+vm_region_t* uvm_region_first(vm_region_t* root, uint64 va);
+void         uvm_region_insert(vm_region_t** root, vm_region_t* region);
+void         uvm_region_remove(vm_region_t** root, vm_region_t* region);
+vm_region_t* uvm_region_split(vm_region_t** root, vm_region_t* region, uint64 addr);
+vm_region_t* uvm_region_merge(vm_region_t** root, vm_region_t* region);
+uint64       uvm_region_hole(vm_region_t* root, uint64 size, uint64 align);
+
 // 其他特殊函数:
 // 在建立第一个进程时负责映射initcode.S
 // 在exec.c中负责建立用户屏障
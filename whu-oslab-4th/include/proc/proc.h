@@ -88,9 +88,14 @@ typedef struct proc{
     struct proc* parent;  // 父进程
     
     /* 内存相关 */
-    uint64 sz;            // 静态区域 + 用户栈[0,sz]
-    uint64 vm_allocable;  // 指向一个可以分配给mmap的虚拟地址 (page_aligned) 
-    vm_region_t* vm_head; // mmap管理的双向循环链表
+    uint64 sz;            // 静态区域 + 用户栈 + 堆[0,sz]
+    uint64 ustack;        // 用户栈[ustack, heap), 下面一页是保护页 (0表示没有)
+    uint64 heap;          // brk堆[heap, sz)
+    uint64 minflt;        // 不需要I/O的缺页次数
+    uint64 majflt;        // 需要读文件的缺页次数
+    vm_region_t* vm_root; // mmap区域树 (按起始地址排序的AVL树)
+    uint64 asid;          // 页表的ASID (高位是分配时的代, 0表示还没有分配)
+    int asid_cpu;         // 上次使用这个ASID的hart
     uint64 kstack;        // 内核栈地址
     context_t ctx;        // 用于swtch.S
     trapframe_t* tf;      // 用于trampoline.S
@@ -103,6 +108,12 @@ typedef struct proc{
     ext4_inode_t*  ext4_cwd;           // 当前目录
     ext4_file_t*  ext4_ofile[NOFILE];  // 打开文件列表
 
+    /* 内核线程 (用户进程为NULL) */
+    void (*kthread)(void); // 内核线程的入口函数
+
+    /* 块设备I/O */
+    int bio_plug;          // bio层攒批的嵌套深度 (只被自己访问)
+
     /* 信号相关 */
     sigaction_t sigactions[NSIG];
     sigset_t    sig_pending;
@@ -116,7 +127,7 @@ typedef struct proc{
 
 int     proc_grow(int n);
 pgtbl_t proc_alloc_pagetable(proc_t* p);
-void    proc_destroy_pagetable(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_head);
+void    proc_destroy_pagetable(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_root);
 void    proc_mapstacks(pgtbl_t pagetable);
 
 // 调度相关
@@ -135,6 +146,7 @@ void proc_sleep(void* channel, spinlock_t* lock);
 void proc_wakeup(void* channel);
 int  proc_kill(int pid);
 void proc_yield(void);
+int  proc_kthread(void (*fn)(void));
 
 // 其他函数
 
@@ -283,4 +283,16 @@ static inline void sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// 只刷新属于asid的TLB项 (全局映射除外)
+static inline void sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
+
+// 只刷新属于asid的va所在页的TLB项
+static inline void sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid) : "memory");
+}
+
 #endif // __ASSEMBLER__
\ No newline at end of file
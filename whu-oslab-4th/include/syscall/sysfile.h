@@ -66,5 +66,7 @@ uint64 sys_sendfile();
 uint64 sys_fcntl();
 uint64 sys_ioctl();
 uint64 sys_ppoll();
+uint64 sys_sync();
+uint64 sys_fsync();
 
 #endif
\ No newline at end of file
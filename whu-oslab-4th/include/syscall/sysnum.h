@@ -31,6 +31,8 @@
 #define SYS_ppoll         73         // 等待一组文件描述符的 I/O 操作变得可读、可写或出现异常条件
 #define SYS_fstatat       79         // 获取文件状态
 #define SYS_fstat         80         // 获取文件状态
+#define SYS_sync          81         // 写回所有缓存的磁盘数据
+#define SYS_fsync         82         // 写回文件相关的缓存数据
 #define SYS_utimensat     88         // 设置文件的时间戳
 #define SYS_renameat2     276        // 文件重命名
 
@@ -55,6 +57,7 @@
 #define SYS_munmap       215         // 链式区域的解除映射
 #define SYS_mmap         222         // 链式区域的映射
 #define SYS_mprotect     226 
+#define SYS_msync        227         // 把共享文件映射的脏页写回
 #define SYS_madvice      233         // 应用程序向操作系统提供有关如何最有效地使用内存页面的建议
 
 // 其他
@@ -24,6 +24,7 @@ uint64 sys_brk();
 uint64 sys_munmap();       
 uint64 sys_mmap();
 uint64 sys_mprotect();
+uint64 sys_msync();
 uint64 sys_madvice();     
 
 uint64 sys_times();
@@ -8,6 +8,7 @@
 #include "dev/vio.h"
 #include "dev/timer.h"
 #include "fs/base_buf.h"
+#include "fs/base_bio.h"
 #include "fs/procfs.h"
 #include "riscv.h"
 volatile static bool first = true;        // 当前核心是否是第一个启动的核心
@@ -36,9 +37,14 @@ void main()
         trap_inithart();    // 修改trap处理函数 + 打开中断总开关
         plic_init();        // 中断控制器
         plic_inithart();    // 使能具体的中断
+        virtio_disk_init(); // 磁盘驱动
+        bio_init();         // 块设备I/O调度
+        buf_init();         // 磁盘缓冲区
         //printf("Waiting for UART input... (type any character)\n");
         
-        proc_userinit();    // 创建第一个用户态进程（首进程）
+        proc_userinit();    // 创建第一个用户态进程（首进程, pid = 1）
+        buf_flusher_init(); // 后台回写线程
+        pmem_zeroer_init(); // 后台清零线程
         proc_schedule();    // 启动CPU0的调度器（不会返回）
         
         // while (1) {
@@ -10,42 +10,140 @@
 #include "lock/lock.h"
 #include "mem/pmem.h"
 #include "proc/proc.h"
+#include "proc/cpu.h"
 #include "fs/base_buf.h"
-
-extern void* vio_mem; // in pmem.c
+#include "dev/timer.h"
 
 // the address of virtio mmio register r
 #define R(r) ((volatile uint32*)(VIO_BASE + (r)))
 #define availOffset (sizeof(struct virtq_desc) * NUM)
-
-// 虚拟的磁盘
-static struct disk {
+// 设备配置空间中的字段 (struct virtio_blk_config)
+#define VIRTIO_MMIO_CONFIG 0x100
+#define VIRTIO_BLK_CFG_NUM_QUEUES 34 // uint16, 只在VIRTIO_BLK_F_MQ时有效
+
+/*
+    多队列: 协商VIRTIO_BLK_F_MQ后每个hart使用自己的虚拟队列 (hart % 队列数)
+    每个队列有独立的描述符、ring和锁, 不同核心上的提交互不争用
+    buf->vq 记录请求所在的队列, 等待者在这个队列的锁上睡眠
+    virtio-mmio只有一条中断线, 无法按队列把中断路由回提交的hart,
+    所以中断处理程序检查所有队列, 只对有完成项的队列加锁
+
+    异步请求队列:
+    virtio_disk_submit 只在分配描述符和发布avail ring时持有队列的锁, 提交后立即返回
+    请求完成时在 virtio_disk_intr 中释放描述符, 然后调用回调函数或唤醒等待者
+    一个请求可以覆盖多个扇区连续的buf (scatter-gather):
+    头部描述符 + 每个buf一个数据描述符 + 状态描述符, 最多VIO_SEG_MAX个buf
+    描述符不够时提交者在 &vq->free[0] 上睡眠
+
+    中断与通知抑制 (VIRTIO_RING_F_EVENT_IDX):
+    提交时只有设备在avail_event处要求通知时才写QUEUE_NOTIFY
+    完成时通过used_event告诉设备何时再发中断:
+    没有同步等待者时, 在全部在途的异步请求完成后才发一次中断
+    有同步等待者时, 下一个请求完成就发中断
+    有进程在轮询时不需要中断
+    降低used_event后要重新检查used ring, 设备可能已经越过了新的位置
+
+    轮询模式: 不超过VIO_POLL_NSEC个扇区的同步请求先轮询VIO_POLL_USEC微秒,
+    超时后再睡眠等待中断, 省掉睡眠/唤醒/上下文切换
+    两者都在编译时选择: 打开Common.mk中的 -D VIO_NO_EVENT_IDX / -D VIO_POLL 后重新编译内核,
+    运行时不能切换 (opt_event_idx / opt_poll 是编译期常量)
+*/
+
+#ifdef VIO_NO_EVENT_IDX
+static const bool opt_event_idx = false;
+#else
+static const bool opt_event_idx = true;
+#endif
+
+#ifdef VIO_POLL
+static const bool opt_poll = true;
+#else
+static const bool opt_poll = false;
+#endif
+
+// 每个队列两个连续的物理页: desc+avail 在第一页, used 在第二页 (legacy接口要求)
+static uint8 vq_mem[NCPU][PAGE_SIZE * 2] __attribute__((aligned(PAGE_SIZE)));
+
+// 一个虚拟队列
+typedef struct virtq {
     struct virtq_desc*  desc;
     struct virtq_avail* avail;
     struct virtq_used*  used;
     char free[NUM];
     uint16 used_idx;
+    int id;          // 队列号 (写入QUEUE_NOTIFY)
+
+    int inflight;    // 在途的请求数
+    int nsync;       // 在途的同步请求数 (done == NULL)
+    int npoller;     // 正在轮询的进程数
 
     struct {
-        buf_t* b;
+        buf_t* b[VIO_SEG_MAX]; // 请求覆盖的buf, 按扇区顺序排列
+        int nb;                // buf的数量
         char status;
+        void (*done)(buf_t*); // 完成时的回调函数, NULL表示唤醒等待者
+        uint64 stamp;          // 提交时间, 用于统计延迟
+        volatile bool* wait;   // 直接I/O: 完成时清零并唤醒 (不经过buf)
     } info[NUM];
     struct virtio_blk_req ops[NUM];
+    vio_stat_t st;   // 本队列的统计 (virtio_disk_stat汇总)
     spinlock_t lk;
+} virtq_t;
+
+// 虚拟的磁盘
+static struct disk {
+    bool event_idx;  // 设备是否接受了VIRTIO_RING_F_EVENT_IDX
+    int nq;          // 使用的队列数
+    uint64 nintr;    // 中断次数
+    virtq_t q[NCPU];
+    spinlock_t wait_lk; // 保护nwait, 等待请求下发时在&buf->vq上睡眠
+    int nwait;       // 等待请求被下发的进程数 (见virtio_disk_wait)
 } disk;
 
+// 初始化第i个虚拟队列
+static void virtq_init(int i)
+{
+    virtq_t* vq = &disk.q[i];
+    spinlock_init(&vq->lk, "virtio_disk");
+    vq->id = i;
+
+    // 选择要使用的虚拟队列,将它的下标写入QUEUE_SEL
+    *R(VIRTIO_MMIO_QUEUE_SEL) = i;
+
+    // 检查QUEUE_READY寄存器
+    assert(*R(VIRTIO_MMIO_QUEUE_PFN) == 0, "virtio_disk->virtq_init: 1\n");
+
+    // 读取队列支持的最大大小
+    uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+    assert(max != 0, "virtio_disk->virtq_init: 2\n");
+    assert(max >= NUM, "virtio_disk->virtq_init: 3\n");
+
+    // 使用静态的两页内存存放三个虚拟队列
+    vq->desc  = (void*)vq_mem[i];
+    vq->avail = (void*)((uint64)vq->desc + availOffset);
+    vq->used  = (void*)((uint64)vq->desc + PAGE_SIZE);
+    memset(vq->desc, 0, PAGE_SIZE * 2);
+
+    // 设置队列的大小
+	*R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+	// 设置Queue Align
+	*R(VIRTIO_MMIO_QUEUE_ALIGN) = PAGE_SIZE;
+	// 设置QUEUE PFN
+	*R(VIRTIO_MMIO_QUEUE_PFN) = (uint64)vq->desc >> 12;
+
+    // free数组初始化
+    for(int j=0; j<NUM; j++)
+        vq->free[j] = 1;
+
+}
 
 void virtio_disk_init(void)
 {
-    spinlock_init(&disk.lk,"virtio_disk");
-
     assert(*R(VIRTIO_MMIO_MAGIC_VALUE) == 0x74726976, "virtio_disk->init: 1\n");
     assert(*R(VIRTIO_MMIO_VERSION) == 1, "virtio_disk->init: 2\n");
     assert(*R(VIRTIO_MMIO_DEVICE_ID) == 2, "virtio_disk->init: 3\n");
     assert(*R(VIRTIO_MMIO_VENDOR_ID) == 0x554d4551, "virtio_disk->init: 4\n");
 
-    spinlock_acquire(&disk.lk);
-
     uint32 status = 0;
     // 重置设备
     *R(VIRTIO_MMIO_STATUS) = status;
@@ -63,86 +161,77 @@ void virtio_disk_init(void)
 	features &= ~(1 << VIRTIO_BLK_F_RO);
 	features &= ~(1 << VIRTIO_BLK_F_SCSI);
 	features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-	features &= ~(1 << VIRTIO_BLK_F_MQ);
 	features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-	features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
+	if(!opt_event_idx)
+		features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
 	features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
 	*R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+	disk.event_idx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
+
+    spinlock_init(&disk.wait_lk, "virtio_wait");
+    disk.nwait = 0;
+
+    // 队列数: 设备支持的数量和hart数量中较小的一个
+    disk.nq = 1;
+    if(features & (1 << VIRTIO_BLK_F_MQ)) {
+        uint16 nq = *(volatile uint16*)(VIO_BASE + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CFG_NUM_QUEUES);
+        disk.nq = nq < NCPU ? nq : NCPU;
+        if(disk.nq < 1) disk.nq = 1;
+    }
 
     // 设置设备FEATURE_OK位 驱动不再接受新的工作特性
     // status |= VIO_CONFIG_S_FEATURES_OK;
     // *R(VIO_MMIO_STATUS) = status; 
     // assert(*R(VIO_MMIO_STATUS) & VIO_CONFIG_S_FEATURES_OK,"virtio_disk->init: 5\n");
-    
-    // 选择要使用的虚拟队列,将它的下标写入QUEUE_SEL
-    *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-    
-    // 检查QUEUE_READY寄存器
-    assert(*R(VIRTIO_MMIO_QUEUE_PFN) == 0, "virtio_disk->init: 6\n");
-    
-    // 读取队列支持的最大大小
-    uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-    assert(max != 0, "virtio_disk->init: 7\n");
-    assert(max >= NUM, "virtio_disk->init: 8\n");
 
     *R(VIRTIO_MMIO_PAGE_SIZE) = PAGE_SIZE;
 
-    // 在内存中申请空白页存放三个虚拟队列
-    disk.desc  = (void*)vio_mem;
-    disk.avail = (void*)((uint64)disk.desc + availOffset);
-    disk.used  = (void*)((uint64)disk.desc + PAGE_SIZE);
-    assert((disk.desc!=NULL) && (disk.used!=NULL) , "virtio_disk->init: 9\n");
-    memset(disk.desc, 0, PAGE_SIZE * 2);
-
-    // 设置队列的大小
-	*R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-	// 设置Queue Align
-	*R(VIRTIO_MMIO_QUEUE_ALIGN) = PAGE_SIZE;
-	// 设置QUEUE PFN
-	*R(VIRTIO_MMIO_QUEUE_PFN) = (uint64)disk.desc >> 12;
-
-    // free数组初始化
-    for(int i=0; i<NUM; i++) 
-        disk.free[i] = 1;
+    for(int i = 0; i < disk.nq; i++)
+        virtq_init(i);
     
     // 至此设备激活
     status |= VIRTIO_CONFIG_S_DRIVER_OK;
     *R(VIRTIO_MMIO_STATUS) = status;
+}
 
-    spinlock_release(&disk.lk);
+// 当前hart使用的队列
+static virtq_t* local_vq(void)
+{
+    push_off();
+    virtq_t* vq = &disk.q[mycpuid() % disk.nq];
+    pop_off();
+    return vq;
 }
 
-static int alloc_desc()
+static int alloc_desc(virtq_t* vq)
 {
     for(int i=0; i<NUM; i++) {
-        if(disk.free[i]) {
-            disk.free[i] = 0;
+        if(vq->free[i]) {
+            vq->free[i] = 0;
             return i;
         }
     }
     return -1;
 }
 
-static void free_desc(int id)
+static void free_desc(virtq_t* vq, int id)
 {
     assert((id < NUM) && (id >= 0), "vitrio_disk->free_desc: 1\n");
-    assert(disk.free[id] == 0, "vitrio_disk->free_desc: 1\n");
+    assert(vq->free[id] == 0, "vitrio_disk->free_desc: 1\n");
 
-    disk.desc[id].addr = 0;
-    disk.desc[id].flags = 0;
-    disk.desc[id].len = 0;
-    disk.desc[id].next = 0;
-    disk.free[id] = 1;
-    
-    // proc_wakeup(&disk.free[0]);
+    vq->desc[id].addr = 0;
+    vq->desc[id].flags = 0;
+    vq->desc[id].len = 0;
+    vq->desc[id].next = 0;
+    vq->free[id] = 1;
 }
 
-static void free_chain(int id)
+static void free_chain(virtq_t* vq, int id)
 {
     while(1) {
-        int flags = disk.desc[id].flags;
-        int next = disk.desc[id].next;
-        free_desc(id);
+        int flags = vq->desc[id].flags;
+        int next = vq->desc[id].next;
+        free_desc(vq, id);
         if(flags & VRING_DESC_F_NEXT) { 
             id = next;
         } else { 
@@ -151,97 +240,343 @@ static void free_chain(int id)
     }
 }
 
-static int alloc3_desc(int* idx)
+/*
+    告诉设备下一次什么时候发中断, 调用者持有vq->lk
+    返回后调用者需要重新检查used ring (见disk_reap)
+*/
+static void intr_arm(virtq_t* vq)
+{
+    if(disk.event_idx) {
+        uint16 event;
+        if(vq->npoller > 0)
+            event = vq->used_idx - 1;  // 要绕一整圈才会触发, 相当于关闭
+        else if(vq->nsync == 0 && vq->inflight > 0)
+            event = vq->used_idx + vq->inflight - 1; // 全部完成时
+        else
+            event = vq->used_idx;      // 下一个完成时
+        vq->avail->used_event = event;
+    } else {
+        vq->avail->flags = vq->npoller > 0 ? VRING_AVAIL_F_NO_INTERRUPT : 0;
+    }
+    __sync_synchronize();
+}
+
+/*
+    处理设备完成的请求: 释放描述符, 调用回调或唤醒等待者
+    回调函数在持有vq->lk时调用 (锁顺序: vq->lk -> buf层的锁)
+    polled表示在轮询中调用 (只影响统计)
+*/
+static void disk_reap(virtq_t* vq, bool polled)
+{
+    bool freed = false;
+
+again:
+    while(vq->used->idx != vq->used_idx) {
+        __sync_synchronize();
+        int id = vq->used->ring[vq->used_idx % NUM].id;
+        assert(vq->info[id].status == 0, "virtio_disk->reap: 1\n");
+        void (*done)(buf_t*) = vq->info[id].done;
+        int nb = vq->info[id].nb;
+        volatile bool* wait = vq->info[id].wait;
+        vq->info[id].nb = 0;
+        vq->info[id].done = NULL;
+        vq->info[id].wait = NULL;
+        free_chain(vq, id);
+        freed = true;
+
+        uint64 lat = r_time() - vq->info[id].stamp;
+        if(polled) {
+            vq->st.nreq_poll++;
+            vq->st.lat_poll += lat;
+        } else {
+            vq->st.nreq_intr++;
+            vq->st.lat_intr += lat;
+        }
+        if(lat > vq->st.lat_max) vq->st.lat_max = lat;
+        vq->inflight--;
+        if(done == NULL) vq->nsync--;
+
+        // disk is done with bufs
+        __sync_synchronize();
+        for(int i = 0; i < nb; i++) {
+            buf_t* buf = vq->info[id].b[i];
+            vq->info[id].b[i] = 0;
+            assert(buf->disk == true, "virtio_disk->reap: 2\n");
+            buf->disk = false;
+            __sync_synchronize();
+            if(done) done(buf);
+            else proc_wakeup(buf);
+        }
+        if(wait) {
+            *wait = false;
+            proc_wakeup((void*)wait);
+        }
+        vq->used_idx++;
+    }
+
+    // 重新设置中断位置后再检查一次, 避免错过在此期间完成的请求
+    intr_arm(vq);
+    if(vq->used->idx != vq->used_idx) goto again;
+
+    // 有描述符被释放, 唤醒等待描述符的提交者
+    if(freed) proc_wakeup(&vq->free[0]);
+}
+
+// 申请n个描述符, 失败时一个也不占用
+static int allocn_desc(virtq_t* vq, int* idx, int n)
 {
-    for(int i=0; i<3; i++) {
-        idx[i] = alloc_desc();
+    for(int i=0; i<n; i++) {
+        idx[i] = alloc_desc(vq);
         if(idx[i] < 0){
             for(int j=0; j<i; j++)
-                free_desc(idx[j]);
+                free_desc(vq, idx[j]);
             return -1;
         }
     }
     return 0;
 }
 
-void virtio_disk_rw(buf_t* buf, bool write)
+/*
+    在vq中构造一个请求的描述符链: 头部 + n个数据段 + 状态
+    数据段i为物理地址addr[i]开始的len[i]字节
+    描述符不够时在 &vq->free[0] 上睡眠, 返回头部描述符
+    调用者持有vq->lk, 之后填写info[head]并调用vq_publish
+*/
+static int vq_build(virtq_t* vq, uint64 sector, bool write, uint64* addr, uint32* len, int n)
 {
-    uint64 sector = buf->sector; // 计算出扇区号
+    int idx[VIO_SEG_MAX + 2];
+    while(allocn_desc(vq, idx, n + 2) != 0)
+        proc_sleep(&vq->free[0], &vq->lk);
 
-    spinlock_acquire(&disk.lk);
-
-    int idx[3];
-    while(1) {
-        if(alloc3_desc(idx) == 0) break;
-        panic("virtio_disk_rw: 0\n");
-    }
+    int head = idx[0], tail = idx[n + 1];
 
-    struct virtio_blk_req* buf0 = &disk.ops[idx[0]];
+    struct virtio_blk_req* buf0 = &vq->ops[head];
     if(write) buf0->type = VIRTIO_BLK_T_OUT; // write the disk
     else buf0->type = VIRTIO_BLK_T_IN;  // read the disk
     buf0->reserved = 0;
     buf0->sector = sector;
 
-    disk.desc[idx[0]].addr = (uint64)buf0;
-    disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-    disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-    disk.desc[idx[0]].next = idx[1];
+    vq->desc[head].addr = (uint64)buf0;
+    vq->desc[head].len = sizeof(struct virtio_blk_req);
+    vq->desc[head].flags = VRING_DESC_F_NEXT;
+    vq->desc[head].next = idx[1];
+
+    // 每个数据段一个描述符
+    for(int i = 0; i < n; i++) {
+        int d = idx[i + 1];
+        vq->desc[d].addr = addr[i];
+        vq->desc[d].len = len[i];
+        if(write) vq->desc[d].flags = 0;
+        else vq->desc[d].flags = VRING_DESC_F_WRITE;
+        vq->desc[d].flags |= VRING_DESC_F_NEXT;
+        vq->desc[d].next = idx[i + 2];
+    }
 
-    disk.desc[idx[1]].addr = (uint64)buf->data;
-    disk.desc[idx[1]].len = SECTOR_SIZE;
-    if(write) disk.desc[idx[1]].flags = 0;
-    else disk.desc[idx[1]].flags = VRING_DESC_F_WRITE;
-    disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-    disk.desc[idx[1]].next = idx[2];
+    vq->info[head].status = 0xff;
+    vq->desc[tail].addr = (uint64)&vq->info[head].status;
+    vq->desc[tail].len = 1;
+    vq->desc[tail].flags = VRING_DESC_F_WRITE;
+    vq->desc[tail].next = 0;
 
-    disk.info[idx[0]].status = 0xff;
-    disk.desc[idx[2]].addr = (uint64)&disk.info[idx[0]].status;
-    disk.desc[idx[2]].len = 1;
-    disk.desc[idx[2]].flags = VRING_DESC_F_WRITE;
-    disk.desc[idx[2]].next = 0;
+    return head;
+}
 
-    buf->disk = true;
-    disk.info[idx[0]].b = buf;
+// 把head开始的请求交给设备, 调用者持有vq->lk
+static void vq_publish(virtq_t* vq, int head, bool sync)
+{
+    vq->info[head].stamp = r_time();
+    vq->inflight++;
+    if(sync) vq->nsync++;
 
-    disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+    uint16 old = vq->avail->idx;
+    vq->avail->ring[old % NUM] = head;
 
     __sync_synchronize();
-    disk.avail->idx++;
+    vq->avail->idx = old + 1;
     __sync_synchronize();
 
-    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+    // 设备正在处理队列时不需要再通知它
+    bool kick;
+    if(disk.event_idx) kick = vring_need_event(vq->used->avail_event, old + 1, old);
+    else kick = !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+    if(kick) {
+        *R(VIRTIO_MMIO_QUEUE_NOTIFY) = vq->id;
+        vq->st.nnotify++;
+    } else {
+        vq->st.nsuppress++;
+    }
+
+    // 在途请求变了, 重新设置中断位置
+    disk_reap(vq, false);
+}
+
+/*
+    提交一个读写请求, 不等待完成
+    请求覆盖bufs[0..n)这n个扇区连续的buf, 每个buf对应一个数据描述符
+    done != NULL: 请求完成时在中断上下文中对每个buf调用done(buf), 它不能睡眠
+    done == NULL: 请求完成时唤醒在buf上等待的进程 (见virtio_disk_wait)
+    描述符不够时会睡眠, 调用者不能持有自旋锁
+*/
+void virtio_disk_submit_vec(buf_t** bufs, int n, bool write, void (*done)(buf_t*))
+{
+    assert(n >= 1 && n <= VIO_SEG_MAX, "virtio_disk_submit_vec: 0\n");
+    for(int i = 1; i < n; i++)
+        assert(bufs[i]->sector == bufs[i-1]->sector + bufs[i-1]->nsec, "virtio_disk_submit_vec: 1\n");
+
+    uint64 addr[VIO_SEG_MAX];
+    uint32 len[VIO_SEG_MAX];
+    for(int i = 0; i < n; i++) {
+        addr[i] = (uint64)bufs[i]->data;
+        len[i] = bufs[i]->nsec * SECTOR_SIZE;
+    }
 
-    // Wait for virtio_disk_intr() to say request has finished.
-    while (buf->disk == true)
-        proc_sleep(buf, &disk.lk);
+    virtq_t* vq = local_vq();
+    spinlock_acquire(&vq->lk);
+
+    int head = vq_build(vq, bufs[0]->sector, write, addr, len, n);
+    for(int i = 0; i < n; i++) {
+        bufs[i]->disk = true;
+        bufs[i]->vq = vq->id;
+        vq->info[head].b[i] = bufs[i];
+    }
+    vq->info[head].nb = n;
+    vq->info[head].done = done;
+    vq_publish(vq, head, done == NULL);
 
-    disk.info[idx[0]].b = 0;
-    free_chain(idx[0]);
+    spinlock_release(&vq->lk);
 
-    spinlock_release(&disk.lk);
+    // 唤醒等待这些buf被下发的进程
+    spinlock_acquire(&disk.wait_lk);
+    if(disk.nwait > 0) {
+        for(int i = 0; i < n; i++)
+            proc_wakeup(&bufs[i]->vq);
+    }
+    spinlock_release(&disk.wait_lk);
 }
 
-void virtio_disk_intr()
+/*
+    直接I/O: 在磁盘[sector, ...)和n个物理内存段之间同步传输, 不经过buf
+    段的长度必须是SECTOR_SIZE的倍数, 调用者负责和缓存保持一致
+*/
+void virtio_disk_rw_direct(uint64 sector, vio_seg_t* segs, int n, bool write)
 {
-    spinlock_acquire(&disk.lk);
+    assert(n >= 1 && n <= VIO_SEG_MAX, "virtio_disk_rw_direct: 0\n");
+
+    uint64 addr[VIO_SEG_MAX];
+    uint32 len[VIO_SEG_MAX];
+    for(int i = 0; i < n; i++) {
+        assert(segs[i].len % SECTOR_SIZE == 0, "virtio_disk_rw_direct: 1\n");
+        addr[i] = segs[i].addr;
+        len[i] = segs[i].len;
+    }
 
+    volatile bool busy = true;
+    virtq_t* vq = local_vq();
+    spinlock_acquire(&vq->lk);
+
+    int head = vq_build(vq, sector, write, addr, len, n);
+    vq->info[head].nb = 0;
+    vq->info[head].done = NULL;
+    vq->info[head].wait = &busy;
+    vq_publish(vq, head, true);
+
+    while(busy)
+        proc_sleep((void*)&busy, &vq->lk);
+    spinlock_release(&vq->lk);
+}
+
+// 提交只覆盖一个buf的请求
+void virtio_disk_submit(buf_t* buf, bool write, void (*done)(buf_t*))
+{
+    virtio_disk_submit_vec(&buf, 1, write, done);
+}
+
+/*
+    轮询等待buf的请求完成, 最多VIO_POLL_USEC微秒
+    调用者持有vq->lk, 轮询期间关闭这个队列的中断
+*/
+static void disk_poll(virtq_t* vq, buf_t* buf)
+{
+    vq->npoller++;
+    intr_arm(vq);
+
+    uint64 start = r_time();
+    while(buf->disk == true && r_time() - start < VIO_POLL_USEC * CLOCK_PER_USEC) {
+        // 短暂放锁, 让其他核心可以提交请求
+        spinlock_release(&vq->lk);
+        spinlock_acquire(&vq->lk);
+        disk_reap(vq, true);
+    }
+    if(buf->disk == true) vq->st.npoll_miss++;
+
+    vq->npoller--;
+    disk_reap(vq, false); // 恢复中断并处理在此期间完成的请求
+}
+
+// 等待以 done == NULL 方式提交的请求完成
+void virtio_disk_wait(buf_t* buf)
+{
+    // 请求可能还没有提交到设备 (另一个核心正在下发调度队列), 睡眠到它被下发
+    spinlock_acquire(&disk.wait_lk);
+    disk.nwait++;
+    while(buf->vq < 0 && buf->disk == true)
+        proc_sleep(&buf->vq, &disk.wait_lk);
+    disk.nwait--;
+    spinlock_release(&disk.wait_lk);
+
+    virtq_t* vq = &disk.q[buf->vq < 0 ? 0 : buf->vq];
+    spinlock_acquire(&vq->lk);
+    if(opt_poll && buf->disk == true && buf->nsec <= VIO_POLL_NSEC)
+        disk_poll(vq, buf);
+    while(buf->disk == true)
+        proc_sleep(buf, &vq->lk);
+    spinlock_release(&vq->lk);
+}
+
+// 同步读写: 提交后等待完成
+void virtio_disk_rw(buf_t* buf, bool write)
+{
+    virtio_disk_submit(buf, write, NULL);
+    virtio_disk_wait(buf);
+}
+
+// 磁盘中断: 所有队列共用一条中断线
+void virtio_disk_intr()
+{
     *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+    __sync_fetch_and_add(&disk.nintr, 1);
 
     __sync_synchronize();
 
-    while(disk.used->idx != disk.used_idx) {
-        __sync_synchronize();
-        int id = disk.used->ring[disk.used_idx % NUM].id;
-        assert(disk.info[id].status == 0, "virtio_disk->intr: 1\n");
-        buf_t* buf = disk.info[id].b;
-        // disk is done with buf
-        __sync_synchronize();
-        assert(buf->disk == true, "virtio_disk->intr: 2\n");
-        buf->disk = false;
-        __sync_synchronize();
-        proc_wakeup(buf);
-        disk.used_idx++;
+    for(int i = 0; i < disk.nq; i++) {
+        virtq_t* vq = &disk.q[i];
+        // 不加锁的预检查: 确认中断之后的完成会再次触发中断
+        if(*(volatile uint16*)&vq->used->idx == vq->used_idx) continue;
+        spinlock_acquire(&vq->lk);
+        disk_reap(vq, false);
+        spinlock_release(&vq->lk);
     }
+}
 
-    spinlock_release(&disk.lk);
-}
\ No newline at end of file
+// 读取完成统计 (汇总所有队列)
+void virtio_disk_stat(vio_stat_t* st)
+{
+    memset(st, 0, sizeof(*st));
+    st->event_idx = disk.event_idx;
+    st->poll = opt_poll;
+    st->nqueue = disk.nq;
+    st->nintr = disk.nintr;
+    for(int i = 0; i < disk.nq; i++) {
+        virtq_t* vq = &disk.q[i];
+        spinlock_acquire(&vq->lk);
+        st->nnotify    += vq->st.nnotify;
+        st->nsuppress  += vq->st.nsuppress;
+        st->nreq_intr  += vq->st.nreq_intr;
+        st->nreq_poll  += vq->st.nreq_poll;
+        st->npoll_miss += vq->st.npoll_miss;
+        st->lat_intr   += vq->st.lat_intr;
+        st->lat_poll   += vq->st.lat_poll;
+        if(vq->st.lat_max > st->lat_max) st->lat_max = vq->st.lat_max;
+        spinlock_release(&vq->lk);
+    }
+}
@@ -0,0 +1,168 @@
+/*
+    块设备I/O调度层, 位于buf层和virtio_disk之间
+    buf层通过bio_submit提交单个buf的读写请求, 请求先进入按扇区排序的队列
+    下发时把方向相同、回调相同、扇区相邻的请求合并成一个scatter-gather请求
+    下发顺序是单向电梯(C-SCAN): 从上次下发的位置向扇区号增大的方向扫描, 到头后回绕
+
+    攒批(plug): 进程在bio_plug和bio_unplug之间提交的请求只排队不下发
+    bio_unplug时一次性下发, 使一个系统调用里的突发请求得以排序合并
+    每次下发都会清空整个队列, 所以请求的等待时间不超过一个攒批窗口
+    同步等待(bio_wait)之前总是先下发队列, 避免等待自己还没下发的请求
+*/
+#include "fs/base_bio.h"
+#include "fs/base_buf.h"
+#include "dev/vio.h"
+#include "proc/cpu.h"
+#include "lib/print.h"
+
+// 调度队列 (按(dev, sector)升序排列, 用buf->qnext链接)
+static struct {
+    spinlock_t lk;
+    buf_t* head;
+    int len;          // 队列长度
+    uint32 last_dev;  // 上次下发的请求所在的设备
+    uint64 last;      // 上次下发的请求之后的扇区号
+} bio;
+
+void bio_init(void)
+{
+    spinlock_init(&bio.lk, "bio");
+    bio.head = NULL;
+    bio.len = 0;
+    bio.last_dev = 0;
+    bio.last = 0;
+}
+
+// 请求a是否排在请求b之前
+static bool bio_before(buf_t* a, buf_t* b)
+{
+    if(a->dev != b->dev) return a->dev < b->dev;
+    return a->sector < b->sector;
+}
+
+// 请求b是否排在上次下发的位置(last_dev, last)之前 (调用者持有bio.lk)
+static bool bio_before_last(buf_t* b)
+{
+    if(b->dev != bio.last_dev) return b->dev < bio.last_dev;
+    return b->sector < bio.last;
+}
+
+// b能否接在a后面, 合并成一个请求
+static bool bio_mergeable(buf_t* a, buf_t* b)
+{
+    return a->dev == b->dev && a->qwrite == b->qwrite && a->qdone == b->qdone
+        && a->sector + a->nsec == b->sector;
+}
+
+/*
+    取出整个队列并按电梯顺序下发
+    调用者不能持有bio.lk (virtio_disk_submit_vec可能睡眠)
+*/
+static void bio_dispatch(void)
+{
+    buf_t *list, *b, *prev = NULL;
+
+    spinlock_acquire(&bio.lk);
+    list = bio.head;
+    bio.head = NULL;
+    bio.len = 0;
+
+    // C-SCAN: 从第一个不小于(last_dev, last)的请求开始, 前面的部分接到末尾
+    for(b = list; b != NULL && bio_before_last(b); b = b->qnext)
+        prev = b;
+    if(b != NULL && prev != NULL) {
+        buf_t* tail = b;
+        while(tail->qnext) tail = tail->qnext;
+        prev->qnext = NULL;
+        tail->qnext = list;
+        list = b;
+    }
+    spinlock_release(&bio.lk);
+
+    // 合并相邻请求后下发
+    buf_t* run[VIO_SEG_MAX];
+    int n = 0;
+    while(list != NULL) {
+        b = list;
+        list = list->qnext;
+        b->qnext = NULL;
+
+        if(n > 0 && (n == VIO_SEG_MAX || !bio_mergeable(run[n-1], b))) {
+            virtio_disk_submit_vec(run, n, run[0]->qwrite, run[0]->qdone);
+            n = 0;
+        }
+        run[n++] = b;
+    }
+    if(n > 0) {
+        spinlock_acquire(&bio.lk);
+        bio.last_dev = run[n-1]->dev;
+        bio.last = run[n-1]->sector + run[n-1]->nsec;
+        spinlock_release(&bio.lk);
+        virtio_disk_submit_vec(run, n, run[0]->qwrite, run[0]->qdone);
+    }
+}
+
+/*
+    提交一个请求: 按(dev, sector)顺序插入队列
+    当前进程没有plug时(或队列过长时)立即下发
+    done的含义与virtio_disk_submit相同
+*/
+void bio_submit(buf_t* buf, bool write, void (*done)(buf_t*))
+{
+    proc_t* p = myproc();
+
+    buf->qwrite = write;
+    buf->qdone = done;
+    buf->disk = true;   // 从现在起buf属于I/O层, 完成中断里清除
+    buf->vq = -1;       // 下发时由virtio_disk设置
+
+    spinlock_acquire(&bio.lk);
+    buf_t** pp = &bio.head;
+    while(*pp != NULL && bio_before(*pp, buf))
+        pp = &(*pp)->qnext;
+    buf->qnext = *pp;
+    *pp = buf;
+    bio.len++;
+    bool kick = (p == NULL || p->bio_plug == 0 || bio.len >= BIO_BATCH);
+    spinlock_release(&bio.lk);
+
+    if(kick) bio_dispatch();
+}
+
+// 队列非空时立即下发 (在可能睡眠之前调用, 避免等待自己攒着的请求)
+void bio_kick(void)
+{
+    spinlock_acquire(&bio.lk);
+    bool pending = (bio.head != NULL);
+    spinlock_release(&bio.lk);
+
+    if(pending) bio_dispatch();
+}
+
+// 等待以 done == NULL 方式提交的请求完成
+void bio_wait(buf_t* buf)
+{
+    // 请求可能还在队列里(当前进程处于plug状态)
+    bio_kick();
+    virtio_disk_wait(buf);
+}
+
+// 当前进程开始攒批 (可以嵌套)
+void bio_plug(void)
+{
+    myproc()->bio_plug++;
+}
+
+// 结束攒批, 最外层的unplug下发队列
+void bio_unplug(void)
+{
+    proc_t* p = myproc();
+    assert(p->bio_plug > 0, "bio_unplug: 0\n");
+    if(--p->bio_plug > 0) return;
+
+    spinlock_acquire(&bio.lk);
+    bool kick = (bio.head != NULL);
+    spinlock_release(&bio.lk);
+
+    if(kick) bio_dispatch();
+}
\ No newline at end of file
@@ -1,97 +1,519 @@
 /*
     buf是扇区sector(物理单元)的在内存的副本(还包括其他信息)
     buf层是磁盘管理的顶层,也是文件系统的底层
-    将virtio_disk_rw包装为buf_read和buf_write
+    通过bio层(base_bio.h)读写磁盘, 包装为buf_read和buf_write
+    一个buf可以覆盖1~SEC_PER_BLO个连续扇区, 由一次virtio请求整体读写
+    ext4以block(4KB)为单位使用buf, FAT32的数据区以簇为单位使用buf
+    同一个(dev,sector)必须始终以相同的nsec访问, 否则视为错误
     标准操作流: buf_read => 修改buf->data => buf_write => buf_release
+    预读: buf_prefetch异步地把数据读入缓存, 完成后由中断释放buf, 之后的buf_read直接命中
+
+    查找结构: 以(dev,sector)为键的哈希表,每个桶一把自旋锁
+    命中路径只持有一个桶锁, 不同桶上的查找可以在多核上并行
+    LRU链表只链接ref=0的buf, 由lru.lk保护(叶子锁, 总在桶锁之后获取)
+    未命中时需要搬迁buf, 由evict_lk串行化, 保证同一个键不会被重复插入
+
+    回写策略: buf_write只标记dirty, 对同一个buf的多次修改合并为一次磁盘写
+    后台回写线程每个tick醒来一次, 写回超时的dirty buf
+    dirty比例超过DIRTY_BG_RATIO时全部写回, 超过DIRTY_RATIO时写者自己同步写回
+    换出只选择干净的buf, 找不到时先回写再重试
+    批量回写在bio_plug/bio_unplug之间异步提交, 由bio层排序合并
+    buf_sync(sync/fsync)强制写回所有dirty buf
+
+    锁顺序: evict_lk -> bucket.lk -> lru.lk
 */
 #include "memlayout.h"
 #include "fs/base_buf.h"
-#include "dev/vio.h"
+#include "fs/base_bio.h"
+#include "dev/timer.h"
+#include "proc/proc.h"
 #include "lib/print.h"
 
-// NBUF个buf组成的双向循环链表
-struct {
-    spinlock_t lk;    // buf_cache的锁
-    buf_t bufs[NBUF]; // buf块的数组
-    buf_t head;       // 头节点,不存储实际数据,只使用指针
-} buf_cache;
+#define NBUCKET 13             // 哈希桶数量(取素数使分布均匀)
+#define BUF_NODEV 0xFFFFFFFF   // 尚未使用的buf的设备号,不会被查找命中
+
+#define DIRTY_EXPIRE   3       // dirty超过多少个tick后被后台线程写回
+#define DIRTY_BG_RATIO 25      // dirty buf占比(%)超过它时后台线程全部写回
+#define DIRTY_RATIO    60      // dirty buf占比(%)超过它时写者同步写回
+
+#define RA_INIT 2              // 预读窗口的初始大小
+
+#define HASH(dev, sector) (((dev) * 31 + (sector)) % NBUCKET)
 
-// 初始化buf_cache:包括初始化锁和构造双向循环链表
+// NBUF个buf的存储空间
+static buf_t bufs[NBUF];
+
+// 哈希桶: 每个桶是一个以head开头,NULL结尾的双向链表(hprev/hnext)
+static struct {
+    spinlock_t lk;
+    buf_t* head;
+} bucket[NBUCKET];
+
+// LRU链表: head是最近释放的, tail是最久未使用的
+// lru.lk同时保护ndirty
+static struct {
+    spinlock_t lk;
+    buf_t* head;
+    buf_t* tail;
+    uint32 ndirty;   // dirty buf的数量
+    uint32 nwait;    // 等待空闲buf的进程数量
+    uint32 nwriteback; // 正在异步回写的buf数量
+} lru;
+
+// 串行化未命中时的换出操作
+static spinlock_t evict_lk;
+
+// 哈希链表操作(调用者持有桶锁)
+static void hash_insert(int h, buf_t* b)
+{
+    b->hprev = NULL;
+    b->hnext = bucket[h].head;
+    if(bucket[h].head) bucket[h].head->hprev = b;
+    bucket[h].head = b;
+}
+
+static void hash_remove(int h, buf_t* b)
+{
+    if(b->hprev) b->hprev->hnext = b->hnext;
+    else bucket[h].head = b->hnext;
+    if(b->hnext) b->hnext->hprev = b->hprev;
+}
+
+// LRU链表操作(调用者持有lru.lk)
+static void lru_insert(buf_t* b)
+{
+    b->prev = NULL;
+    b->next = lru.head;
+    if(lru.head) lru.head->prev = b;
+    else lru.tail = b;
+    lru.head = b;
+}
+
+static void lru_remove(buf_t* b)
+{
+    if(b->prev) b->prev->next = b->next;
+    else lru.head = b->next;
+    if(b->next) b->next->prev = b->prev;
+    else lru.tail = b->prev;
+}
+
+static void buf_flusher(void);
+static void buf_put(buf_t* buf);
+
+// 初始化buf_cache:包括初始化锁、哈希桶和LRU链表
 void buf_init(void)
 {
-    spinlock_init(&buf_cache.lk,"buffer cache");
-    buf_cache.head.prev = &buf_cache.head;
-    buf_cache.head.next = &buf_cache.head;
-    // 头插法构造双向循环链表
-    for(buf_t* b = buf_cache.bufs; b < &buf_cache.bufs[NBUF]; b++) {
-        b->next = buf_cache.head.next;
-        b->prev = &buf_cache.head;
+    spinlock_init(&evict_lk, "buf_evict");
+    spinlock_init(&lru.lk, "buf_lru");
+    lru.head = lru.tail = NULL;
+    lru.ndirty = 0;
+    lru.nwait = 0;
+    lru.nwriteback = 0;
+
+    for(int i = 0; i < NBUCKET; i++) {
+        spinlock_init(&bucket[i].lk, "buf_bucket");
+        bucket[i].head = NULL;
+    }
+
+    // 初始时所有buf都是空闲的, 挂在对应的桶和LRU链表上
+    for(buf_t* b = bufs; b < &bufs[NBUF]; b++) {
         sleeplock_init(&b->lk, "buffer");
-        buf_cache.head.next->prev = b;
-        buf_cache.head.next = b;
+        b->dev = BUF_NODEV;
+        b->sector = 0;
+        b->nsec = 0;
+        b->valid = false;
+        b->dirty = false;
+        b->ref = 0;
+        hash_insert(HASH(b->dev, b->sector), b);
+        lru_insert(b);
+    }
+}
+
+// 启动后台回写线程 (首进程创建之后调用)
+void buf_flusher_init(void)
+{
+    int pid = proc_kthread(buf_flusher);
+    assert(pid > 0, "buf_flusher_init: 0\n");
+}
+
+/*
+    在桶中查找(dev,sector)对应的buf, 找到则ref++
+    调用者持有桶锁
+*/
+static buf_t* bucket_lookup(int h, uint32 dev, uint32 sector, uint32 nsec)
+{
+    for(buf_t* b = bucket[h].head; b != NULL; b = b->hnext) {
+        if(b->dev == dev && b->sector == sector) {
+            assert(b->nsec == nsec, "buf.c->bucket_lookup: nsec mismatch\n");
+            if(b->ref == 0) { // 不再空闲, 离开LRU链表
+                spinlock_acquire(&lru.lk);
+                lru_remove(b);
+                spinlock_release(&lru.lk);
+            }
+            b->ref++;
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/*
+    同步写回buf并清除dirty标记
+    调用者持有buf的睡眠锁
+*/
+static void buf_flush(buf_t* b)
+{
+    if(b->dirty == false) return;
+    bio_submit(b, 1, NULL);
+    bio_wait(b);
+    b->dirty = false;
+    spinlock_acquire(&lru.lk);
+    lru.ndirty--;
+    spinlock_release(&lru.lk);
+}
+
+/*
+    异步回写完成时在中断上下文中调用
+    释放flush_dirty获取的睡眠锁和引用
+*/
+static void flush_done(buf_t* b)
+{
+    b->dirty = false;
+    spinlock_acquire(&lru.lk);
+    lru.ndirty--;
+    if(--lru.nwriteback == 0)
+        proc_wakeup(&lru.nwriteback);
+    spinlock_release(&lru.lk);
+    sleeplock_release(&b->lk);
+    buf_put(b);
+}
+
+/*
+    尝试获取b用于回写, 成功时b的ref+1
+    busy = false 时只获取空闲的dirty buf
+    busy = true  时也获取正在被使用的buf (之后会在睡眠锁上等待)
+*/
+static bool flush_grab(buf_t* b, bool busy)
+{
+    bool got = false;
+
+    // 持有evict_lk, b不会被搬到别的桶
+    spinlock_acquire(&evict_lk);
+    int h = HASH(b->dev, b->sector);
+    spinlock_acquire(&bucket[h].lk);
+    if(b->ref == 0 && b->dirty) {
+        spinlock_acquire(&lru.lk);
+        lru_remove(b);
+        spinlock_release(&lru.lk);
+        b->ref = 1;
+        got = true;
+    } else if(b->ref != 0 && busy) {
+        b->ref++;
+        got = true;
     }
+    spinlock_release(&bucket[h].lk);
+    spinlock_release(&evict_lk);
+    return got;
+}
+
+/*
+    写回dirty时间不晚于(ticks - expire)的buf
+    空闲的dirty buf在plug状态下异步提交, 由bio层排序合并成大请求
+    wait = false 时跳过正在被使用的buf (后台线程和换出路径使用, 不会和调用者自己持有的buf死锁)
+    wait = true  时还会等待正在被使用的buf, 并等待所有回写完成 (sync使用, 调用者不能持有任何buf)
+    返回提交回写的buf数量
+*/
+static int flush_dirty(uint64 expire, bool wait)
+{
+    int cnt = 0;
+
+    bio_plug();
+    for(buf_t* b = bufs; b < &bufs[NBUF]; b++) {
+        // 不加锁的预检查, 下面会再次确认
+        if(b->dirty == false || ticks - b->dirty_tick < expire) continue;
+        if(flush_grab(b, false) == false) continue;
+
+        // b是空闲的, 获取睡眠锁不会阻塞
+        sleeplock_acquire(&b->lk);
+        if(b->dirty && ticks - b->dirty_tick >= expire) {
+            spinlock_acquire(&lru.lk);
+            lru.nwriteback++;
+            spinlock_release(&lru.lk);
+            bio_submit(b, 1, flush_done);
+            cnt++;
+        } else {
+            buf_release(b);
+        }
+    }
+    bio_unplug();
+
+    if(wait == false) return cnt;
+
+    // 正在被使用的buf: 不能在plug状态下等待它们的睡眠锁
+    for(buf_t* b = bufs; b < &bufs[NBUF]; b++) {
+        if(b->dirty == false) continue;
+        if(flush_grab(b, true) == false) continue;
+        sleeplock_acquire(&b->lk);
+        if(b->dirty) {
+            buf_flush(b);
+            cnt++;
+        }
+        buf_release(b);
+    }
+
+    spinlock_acquire(&lru.lk);
+    while(lru.nwriteback > 0)
+        proc_sleep(&lru.nwriteback, &lru.lk);
+    spinlock_release(&lru.lk);
+
+    return cnt;
 }
 
 /*
     根据dev和sector的信息搜寻buf,找到符合条件的就返回
-    如果没有符合条件的,尝试返回一个ref_cnt=0的buf
+    如果没有符合条件的,从LRU链表尾部换出一个ref=0的干净buf
     返回的buf是上了锁的
     在函数buffer_read中使用
 */
-static buf_t* buffer_get(uint32 dev, uint32 sector)
+static buf_t* buffer_get(uint32 dev, uint32 sector, uint32 nsec)
 {
-    buf_t *b, *empty = NULL;
-    
-    spinlock_acquire(&buf_cache.lk);
+    int h = HASH(dev, sector);
+    buf_t* b;
 
-    // 遍历查找符合条件的buf并返回
-    for(b = buf_cache.head.next; b != &buf_cache.head; b = b->next) {
-        if(b->dev == dev && b->sector == sector) {
-            b->ref++;
-            goto ret;      
-        } else if(empty == NULL && b->ref == 0) {
-            empty = b;
-        }  
-    }    
-    // 返回一个空闲的buf
-    b = empty;       
+again:
+    // 快速路径: 只持有一个桶锁
+    spinlock_acquire(&bucket[h].lk);
+    b = bucket_lookup(h, dev, sector, nsec);
+    spinlock_release(&bucket[h].lk);
+    if(b != NULL) goto ret;
+
+    // 慢速路径: 换出操作互斥进行
+    spinlock_acquire(&evict_lk);
+
+    // 再次检查, 可能在等待evict_lk期间已经被别的核插入
+    spinlock_acquire(&bucket[h].lk);
+    b = bucket_lookup(h, dev, sector, nsec);
+    spinlock_release(&bucket[h].lk);
     if(b != NULL) {
-        b->dev = dev;
-        b->sector = sector;
-        b->valid = false;
+        spinlock_release(&evict_lk);
+        goto ret;
+    }
+
+    while(1) {
+        // 从最久未使用的一端开始, 取第一个干净的buf
+        spinlock_acquire(&lru.lk);
+        for(b = lru.tail; b != NULL && b->dirty; b = b->prev);
+        spinlock_release(&lru.lk);
+
+        if(b == NULL) {
+            // 空闲buf全是dirty的: 写回后重试 (不能持有自旋锁睡眠)
+            spinlock_release(&evict_lk);
+            if(flush_dirty(0, false) == 0) {
+                // 没有空闲buf (都在使用中或在等待磁盘): 等待有buf被释放
+                // 先下发调度队列, 它里面可能有当前进程攒着的请求
+                bio_kick();
+                spinlock_acquire(&lru.lk);
+                lru.nwait++;
+                while(lru.head == NULL)
+                    proc_sleep(&lru, &lru.lk);
+                lru.nwait--;
+                spinlock_release(&lru.lk);
+            }
+            goto again;
+        }
+
+        // 只有持有evict_lk的核会移动buf, 所以b所在的桶不会变化
+        int vh = HASH(b->dev, b->sector);
+        spinlock_acquire(&bucket[vh].lk);
+        if(b->ref != 0 || b->dirty) { // 刚刚被别人取走或弄脏, 重试
+            spinlock_release(&bucket[vh].lk);
+            continue;
+        }
+        spinlock_acquire(&lru.lk);
+        lru_remove(b);
+        spinlock_release(&lru.lk);
+        hash_remove(vh, b);
         b->ref = 1;
+        spinlock_release(&bucket[vh].lk);
+        break;
     }
 
+    // 此时b不在任何链表中, 其他核无法看到它
+    b->dev = dev;
+    b->sector = sector;
+    b->nsec = nsec;
+    b->valid = false;
+
+    spinlock_acquire(&bucket[h].lk);
+    hash_insert(h, b);
+    spinlock_release(&bucket[h].lk);
+
+    spinlock_release(&evict_lk);
+
 ret:
-    spinlock_release(&buf_cache.lk);
     // 在这一步, 如果这个buf被别的进程占用了, 当前进程会陷入睡眠
-    if(b != NULL) sleeplock_acquire(&b->lk);
-    return b;                 
+    sleeplock_acquire(&b->lk);
+    return b;
 }
 
 /*
     根据dev和sector的信息在内存中找到对应buf或从磁盘中读入
+    buf覆盖[sector, sector+nsec), 一次virtio请求读入
     对buf上锁后返回,若失败则返回NULL
 */
-buf_t* buf_read(uint32 dev, uint32 sector)
+buf_t* buf_read_nsec(uint32 dev, uint32 sector, uint32 nsec)
 {
-    buf_t* buf = buffer_get(dev, sector);
-    assert(buf != NULL, "buf_read\n");
+    assert(nsec >= 1 && nsec <= SEC_PER_BLO, "buf_read_nsec: 0\n");
+    buf_t* buf = buffer_get(dev, sector, nsec);
+    assert(buf != NULL, "buf_read_nsec: 1\n");
     if(buf->valid == false) {   // block在磁盘中
-        virtio_disk_rw(buf, 0); // 读入buf中
+        bio_submit(buf, 0, NULL); // 读入buf中
+        bio_wait(buf);
         buf->valid = true;
     }
     return buf;
 }
 
+// 只读一个扇区
+buf_t* buf_read(uint32 dev, uint32 sector)
+{
+    return buf_read_nsec(dev, sector, 1);
+}
+
 /*
-    把buf的内容写回磁盘
+    标记buf已被修改, 由后台线程延迟写回磁盘
+    dirty buf过多时由调用者同步写回
     注意调用者须持有buf的锁
 */
 void buf_write(buf_t* buf)
 {
     assert(sleeplock_holding(&buf->lk), "buf.c->write\n");
-    virtio_disk_rw(buf, 1);
+
+    uint32 ndirty;
+    spinlock_acquire(&lru.lk);
+    if(buf->dirty == false) {
+        buf->dirty = true;
+        buf->dirty_tick = ticks;
+        lru.ndirty++;
+    }
+    ndirty = lru.ndirty;
+    spinlock_release(&lru.lk);
+
+    if(ndirty * 100 >= NBUF * DIRTY_RATIO)
+        buf_flush(buf);
+}
+
+/*
+    把所有dirty buf写回磁盘
+    注意调用者不能持有任何buf的锁
+*/
+void buf_sync(void)
+{
+    flush_dirty(0, true);
+}
+
+// 缓存的统计信息 (不加锁的快照)
+void buf_stat(buf_stat_t* st)
+{
+    st->nbuf = NBUF;
+    st->nvalid = 0;
+    st->nbytes = 0;
+    for(buf_t* b = bufs; b < &bufs[NBUF]; b++) {
+        if(b->valid) {
+            st->nvalid++;
+            st->nbytes += b->nsec * SECTOR_SIZE;
+        }
+    }
+    spinlock_acquire(&lru.lk);
+    st->ndirty = lru.ndirty;
+    st->nwriteback = lru.nwriteback;
+    spinlock_release(&lru.lk);
+}
+
+// b是否缓存了dev上与[sector, sector+nsec)重叠的扇区
+static inline bool buf_overlap(buf_t* b, uint32 dev, uint32 sector, uint32 nsec)
+{
+    return b->dev == dev && b->sector < sector + nsec && sector < b->sector + b->nsec;
+}
+
+/*
+    让缓存和磁盘上的[sector, sector+nsec)保持一致 (直接I/O之前调用)
+    与区间重叠的dirty buf先同步写回
+    drop = true 时还把它们标记为无效, 之后的buf_read会重新从磁盘读入
+    调用者不能持有任何buf
+*/
+void buf_sync_range(uint32 dev, uint32 sector, uint32 nsec, bool drop)
+{
+    for(buf_t* b = bufs; b < &bufs[NBUF]; b++) {
+        // 不加锁的预检查, 下面会再次确认
+        if(!buf_overlap(b, dev, sector, nsec)) continue;
+        if(!drop && b->dirty == false) continue;
+
+        // 持有evict_lk, b不会被搬到别的桶
+        bool got = false;
+        spinlock_acquire(&evict_lk);
+        int h = HASH(b->dev, b->sector);
+        spinlock_acquire(&bucket[h].lk);
+        if(buf_overlap(b, dev, sector, nsec)) {
+            if(b->ref == 0) {
+                spinlock_acquire(&lru.lk);
+                lru_remove(b);
+                spinlock_release(&lru.lk);
+            }
+            b->ref++;
+            got = true;
+        }
+        spinlock_release(&bucket[h].lk);
+        spinlock_release(&evict_lk);
+        if(got == false) continue;
+
+        // 等待正在进行的读入或回写结束
+        sleeplock_acquire(&b->lk);
+        buf_flush(b);
+        if(drop) b->valid = false;
+        buf_release(b);
+    }
+}
+
+/*
+    后台回写线程: 每个tick醒来一次
+*/
+static void buf_flusher(void)
+{
+    uint64 last;
+
+    while(1) {
+        spinlock_acquire(&ticks_lk);
+        last = ticks;
+        while(ticks == last)
+            proc_sleep(&ticks, &ticks_lk);
+        spinlock_release(&ticks_lk);
+
+        if(lru.ndirty * 100 >= NBUF * DIRTY_BG_RATIO)
+            flush_dirty(0, false);
+        else
+            flush_dirty(DIRTY_EXPIRE, false);
+    }
+}
+
+/*
+    ref--, 减到0时放入LRU链表头部
+    调用者已经释放了buf的睡眠锁
+*/
+static void buf_put(buf_t* buf)
+{
+    int h = HASH(buf->dev, buf->sector);
+    spinlock_acquire(&bucket[h].lk);
+    buf->ref--;
+    // no one is waiting for it
+    if(buf->ref == 0) {
+        // buf成为LRU链表的第一个,最晚被换出
+        spinlock_acquire(&lru.lk);
+        lru_insert(buf);
+        if(lru.nwait > 0) proc_wakeup(&lru);
+        spinlock_release(&lru.lk);
+    }
+    spinlock_release(&bucket[h].lk);
 }
 
 /*
@@ -103,19 +525,102 @@ void buf_release(buf_t* buf)
     // 释放buf的锁
     assert(sleeplock_holding(&buf->lk), "buf.c->release: 2\n");
     sleeplock_release(&buf->lk);
-    
-    spinlock_acquire(&buf_cache.lk);
-    buf->ref--;
-    // no one is waiting for it
-    if(buf->ref == 0) {
-        // buf从原来的位置中离开
-        buf->next->prev = buf->prev;
-        buf->prev->next = buf->next;
-        // buf成为head的下一个,更易被使用
-        buf->next = buf_cache.head.next; 
-        buf->prev = &buf_cache.head;
-        buf_cache.head.next->prev = buf;
-        buf_cache.head.next = buf;
-    }
-    spinlock_release(&buf_cache.lk);
+    buf_put(buf);
+}
+
+/*
+    预读完成时在中断上下文中调用
+    提交预读的进程已经不再关心这个buf, 所以这里不检查睡眠锁的持有者
+*/
+static void prefetch_done(buf_t* buf)
+{
+    buf->valid = true;
+    sleeplock_release(&buf->lk);
+    buf_put(buf);
+}
+
+// (dev,sector)是否已经在缓存中
+static bool buf_cached(uint32 dev, uint32 sector)
+{
+    int h = HASH(dev, sector);
+    bool cached = false;
+
+    spinlock_acquire(&bucket[h].lk);
+    for(buf_t* b = bucket[h].head; b != NULL; b = b->hnext) {
+        if(b->dev == dev && b->sector == sector) {
+            cached = true;
+            break;
+        }
+    }
+    spinlock_release(&bucket[h].lk);
+    return cached;
+}
+
+/*
+    把连续的count个单元 [sector + i*nsec, sector + (i+1)*nsec) 读入缓存
+    在plug状态下逐个提交, 扇区相邻的单元由bio层合并成scatter-gather请求
+    异步完成: 提交请求后立即返回, buf在完成前保持上锁
+    之后的buf_read会在睡眠锁上等待读入完成
+    已提交未下发的buf不在LRU中, 一次最多预读RA_MAX个单元, 防止攒批时耗尽缓存
+    更长的区间由调用者随着读取的推进分批预读
+*/
+void buf_prefetch_run(uint32 dev, uint32 sector, uint32 nsec, uint32 count)
+{
+    count = min(count, RA_MAX);
+    bio_plug();
+    for(uint32 i = 0; i < count; i++) {
+        uint32 s = sector + i * nsec;
+        if(buf_cached(dev, s)) continue;
+
+        buf_t* buf = buffer_get(dev, s, nsec);
+        if(buf->valid) {  // 在检查和获取之间被别人读入了
+            buf_release(buf);
+            continue;
+        }
+        bio_submit(buf, 0, prefetch_done);
+    }
+    bio_unplug();
+}
+
+// 预读一个单元
+void buf_prefetch(uint32 dev, uint32 sector, uint32 nsec)
+{
+    buf_prefetch_run(dev, sector, nsec, 1);
+}
+
+// 预读窗口复位 (打开文件时调用)
+void buf_ra_reset(ra_state_t* ra)
+{
+    ra->next_off = 0;
+    ra->win = 0;
+    ra->ra_end = 0;
+}
+
+/*
+    根据本次读取的文件区间[off, off+len)更新预读窗口
+    顺序读取时窗口翻倍(上限RA_MAX), 随机读取时窗口减半且不预读
+    unit是预读的单位(字节数), 窗口大小以unit计
+    返回需要预读的字节数, 预读区间的起点放在ra_off中
+*/
+uint32 buf_ra_update(ra_state_t* ra, uint32 off, uint32 len, uint32 unit, uint32* ra_off)
+{
+    uint32 end = off + len;
+    bool seq = (off == ra->next_off);
+
+    ra->next_off = end;
+    if(seq == false) {
+        ra->win = ra->win / 2;
+        ra->ra_end = end;
+        return 0;
+    }
+    ra->win = (ra->win == 0) ? RA_INIT : min(ra->win * 2, RA_MAX);
+
+    // 预读区间是本次读取之后的win个unit, 已经预读过的部分跳过
+    uint32 start = max(ra->ra_end, end);
+    uint32 stop = ALIGN_UP(end, unit) + ra->win * unit;
+    if(start >= stop) return 0;
+
+    ra->ra_end = stop;
+    *ra_off = start;
+    return stop - start;
 }
\ No newline at end of file
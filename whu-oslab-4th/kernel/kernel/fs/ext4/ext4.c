@@ -24,12 +24,11 @@ void ext4_init(uint32 dev, uint32 sb_sector)
 	// 注意: 第一个 4KB block 中 
 	// 最先的 1KB 不可读取的引导部分
 	// 后面的 1KB 是可以读取的超级块
-	buf_t* buf = buf_read(dev, sb_sector);
-	memmove(mem, buf->data, SECTOR_SIZE);
-	buf_release(buf);
-
-	buf = buf_read(dev, sb_sector + 1);
-	memmove(mem + SECTOR_SIZE, buf->data, SECTOR_SIZE);
+	// 超级块所在的block整体读入, 再取出对应的1KB
+	uint32 sb_off = (sb_sector % SEC_PER_BLO) * SECTOR_SIZE;
+	assert(sb_off + 2 * SECTOR_SIZE <= BLOCK_SIZE, "ext4_init: -1");
+	buf_t* buf = ext4_block_buf(dev, sb_sector / SEC_PER_BLO);
+	memmove(mem, buf->data + sb_off, 2 * SECTOR_SIZE);
 	buf_release(buf);
 	
 	memmove(&sb, mem, sizeof(sb));
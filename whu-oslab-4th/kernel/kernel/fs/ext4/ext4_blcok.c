@@ -2,6 +2,7 @@
 #include "fs/ext4_block.h"
 #include "fs/base_buf.h"
 #include "mem/vmem.h"
+#include "mem/pmem.h"
 #include "proc/cpu.h"
 #include "lib/str.h"
 #include "lib/print.h"
@@ -10,6 +11,13 @@ extern ext4_superblock_t ext4_sb;
 extern ext4_group_desc_t ext4_gd[NGROUP];
 
 
+// 获取block对应的buf (一个buf覆盖整个block, 一次virtio请求读入)
+// 返回的buf是上了锁的, 调用者负责buf_release
+buf_t* ext4_block_buf(uint32 dev, uint32 block_num)
+{
+	return buf_read_nsec(dev, block_num * SEC_PER_BLO, SEC_PER_BLO);
+}
+
 // 读取磁盘中的一个block到dst指向的存储空间中
 // 返回成功读取的长度
 uint32 ext4_block_read(uint32 dev, uint32 block_num, uint32 off, uint32 len, void* dst, bool user_dst)
@@ -17,29 +25,11 @@ uint32 ext4_block_read(uint32 dev, uint32 block_num, uint32 off, uint32 len, voi
 	assert(block_num != 0, "ext4_block_read: 0");
 	assert(off + len <= BLOCK_SIZE, "ext4_blcok_read: 1");
 
-	buf_t* buf = NULL;
-	uint32 left_len = len, cut_len = 0;
-	uint32 begin = off % SECTOR_SIZE;
-
-	for(uint32 i = off / SECTOR_SIZE; i < SEC_PER_BLO; i++) 
-	{
-		// 确认读入的长度
-		cut_len = min(SECTOR_SIZE - begin, left_len);
-		
-		// 读入
-		buf = buf_read(dev, block_num * SEC_PER_BLO + i);
-		if(vm_copyout(user_dst, (uint64)dst, buf->data + begin, cut_len) < 0)
-			break;
-		buf_release(buf);
-		
-		// 迭代更新
-		begin = 0;
-		left_len -= cut_len;
-		dst      += cut_len;
-		if(left_len == 0) break;
-	}
+	buf_t* buf = ext4_block_buf(dev, block_num);
+	int ret = vm_copyout(user_dst, (uint64)dst, buf->data + off, len);
+	buf_release(buf);
 
-	return len - left_len;
+	return ret < 0 ? 0 : len;
 }
 
 // 将src指向的存储空间的数据写入磁盘的一个block中
@@ -48,45 +38,37 @@ uint32 ext4_block_write(uint32 dev, uint32 block_num, uint32 off, uint32 len, vo
 	assert(block_num != 0, "ext4_block_write: 0");
 	assert(off + len <= BLOCK_SIZE, "ext4_blcok_write: 1");
 
-	buf_t* buf = NULL;
-	uint32 left_len = len, cut_len = 0;
-	uint32 begin = off % SECTOR_SIZE;
-
-	for(uint32 i = off / SECTOR_SIZE; i < SEC_PER_BLO; i++) 
-	{
-		// 确认写入的长度
-		cut_len = min(SECTOR_SIZE - begin, left_len);
-		
-		// 写入
-		buf = buf_read(dev, block_num * SEC_PER_BLO + i);
-		if(vm_copyin(user_src, buf->data + begin, (uint64)src, cut_len) < 0)
-			break;
-		buf_write(buf);
-		buf_release(buf);
-		
-		// 迭代更新
-		begin = 0;
-		left_len -= cut_len;
-		src      += cut_len;
-		if(left_len == 0) break;
+	// 用户数据先拷到临时页: 拷贝失败时buf里不会留下写了一半的数据 (脏buf也一样)
+	// 而且缺页处理不会在持有buf锁时发生
+	void* tmp = NULL;
+	if(user_src) {
+		if((tmp = pmem_alloc_pages(1, true)) == NULL)
+			return 0;
+		if(vm_copyin(true, tmp, (uint64)src, len) < 0) {
+			pmem_free_pages(tmp, 1, true);
+			return 0;
+		}
+		src = tmp;
 	}
 
-	return len - left_len;
+	buf_t* buf = ext4_block_buf(dev, block_num);
+	memmove(buf->data + off, src, len);
+	buf_write(buf);
+	buf_release(buf);
+
+	if(tmp != NULL)
+		pmem_free_pages(tmp, 1, true);
+	return len;
 }
 
 // 清空一个block
 void ext4_block_zero(uint32 dev, uint32 block_num)
 {
 	assert(block_num != 0, "ext4_block_read: 0");
-	buf_t* buf = NULL;
-	int sector_per_block  = SEC_PER_BLO;
-
-	for(int i = 0; i < sector_per_block; i++) {
-		buf = buf_read(dev, block_num * sector_per_block + i);
-		memset(buf->data, 0, SECTOR_SIZE);
-		buf_write(buf);
-		buf_release(buf);
-	}
+	buf_t* buf = ext4_block_buf(dev, block_num);
+	memset(buf->data, 0, BLOCK_SIZE);
+	buf_write(buf);
+	buf_release(buf);
 }
 
 // 获取一个清零的block (block bitmap 0->1)
@@ -97,27 +79,26 @@ uint32 ext4_block_alloc(uint32 dev)
 	buf_t* buf;
 	
 	for(uint32 i = 0; i < NGROUP; i++) {                  // 遍历每个group的bitmap
-		for(uint32 j = 0; j < SEC_PER_BLO; j++) {         // 对于当前bitmap中的每个sector
- 			buf = buf_read(dev, ext4_gd[i].block_bitmap * SEC_PER_BLO + j);
-			for(uint32 k = 0; k < SECTOR_SIZE; k++) {     // 遍历sector中的每个字节
-				mask = 1;
-				for(uint32 a = 0; ; a++) {                // 遍历字节中的每个bit
-					if( !(mask & buf->data[k]) ) {
-						// bitmap修改并写回
-						buf->data[k] |=  mask;
-						buf_write(buf);
-						buf_release(buf);
-						// 清空对应block
-						block_num = (i * BLOCK_SIZE + j * SECTOR_SIZE + k) * 8 + a;
-						ext4_block_zero(dev, block_num);
-						goto ret;
-					}
-					if(a == 7) break;
-					mask = mask << 1;
+		buf = ext4_block_buf(dev, ext4_gd[i].block_bitmap);
+		for(uint32 k = 0; k < BLOCK_SIZE; k++) {          // 遍历bitmap中的每个字节
+			if(buf->data[k] == 0xFF) continue;           // 整个字节已满, 跳过
+			mask = 1;
+			for(uint32 a = 0; ; a++) {                    // 遍历字节中的每个bit
+				if( !(mask & buf->data[k]) ) {
+					// bitmap修改并写回
+					buf->data[k] |=  mask;
+					buf_write(buf);
+					buf_release(buf);
+					// 清空对应block
+					block_num = (i * BLOCK_SIZE + k) * 8 + a;
+					ext4_block_zero(dev, block_num);
+					goto ret;
 				}
+				if(a == 7) break;
+				mask = mask << 1;
 			}
-			buf_release(buf);
-		}		
+		}
+		buf_release(buf);
 	}
 ret:
 	return block_num;
@@ -128,13 +109,11 @@ void ext4_block_free(uint32 dev, uint32 block_num)
 {
 	uint32 i = block_num / ext4_sb.block_per_group; // 隶属第i个group
 	uint32 j = block_num % ext4_sb.block_per_group; // 在group内的第j个block
-	uint32 a = j % (SECTOR_SIZE * 8);               // 在第b个sector里的第a个bit
-	uint32 b = j / (SECTOR_SIZE * 8);               // 属于第b个sector
+	uint32 a = j % (BLOCK_SIZE * 8);                // 在bitmap里的第a个bit
 	uint8  mask = 1 << (a % 8);
-	uint32 sector_num = ext4_gd[i].block_bitmap * SEC_PER_BLO + b; // 目标bit所在的sector
 
 	assert( i < NGROUP, "ext4_block_free: -1");
-	buf_t* buf = buf_read(dev, sector_num);
+	buf_t* buf = ext4_block_buf(dev, ext4_gd[i].block_bitmap);
 	assert(buf->data[a / 8] & mask, "ext4_block_free: 0");
 	buf->data[a / 8] = buf->data[a / 8] & (~mask);
 	buf_write(buf);
@@ -2,46 +2,37 @@
 #include "fs/ext4_dir.h"
 #include "fs/ext4_file.h"
 #include "fs/ext4_pipe.h"
+#include "fs/ext4_pcache.h"
 #include "lib/print.h"
 #include "proc/cpu.h"
 #include "mem/vmem.h"
+#include "mem/slab.h"
 
 ext4_dev_t  ext4_devlist[NDEV];    // 设备列表
-static ext4_file_t ext4_ftable[NFILE];   // 文件列表
+static kmem_cache_t* ext4_file_cache;    // 文件对象的slab cache
 
-// 文件列表初始化(单核执行)
+// 文件cache初始化(单核执行)
 void ext4_file_init()
 {
-    for(ext4_file_t* file = &ext4_ftable[0]; file < &ext4_ftable[NFILE]; file++) {
-        file->file_type = TYPE_UNKNOWN;
-        file->ref = 0;
-        file->off = 0;
-        file->major = 0;
-        file->flags_high = 0;
-        file->flags_low = 0;
-        file->ip = NULL;
-        file->pipe = NULL;
-        file->oflags = FLAGS_RDONLY;
-        spinlock_init(&file->lk, "file lock");
-    }
+    ext4_file_cache = kmem_cache_create("ext4_file", sizeof(ext4_file_t));
+    ext4_pipe_init();
+    ext4_pcache_init();
 }
 
-// 在ftable中申请一个空闲的file
+// 申请一个新的file
 // file->ref: 0->1
+// 成功返回文件指针 失败返回NULL
 ext4_file_t* ext4_file_alloc()
 {
-    ext4_file_t* file;
-    for(file = &ext4_ftable[0]; file < &ext4_ftable[NFILE]; file++) {
-        spinlock_acquire(&file->lk);
-        if(file->ref == 0) {
-            file->ref = 1;
-            spinlock_release(&file->lk);
-            return file;
-        }
-        spinlock_release(&file->lk);
-    }
-    panic("ext4_file_alloc: 0");
-    return NULL;
+    ext4_file_t* file = kmem_cache_zalloc(ext4_file_cache);
+    if(file == NULL) return NULL;
+
+    file->file_type = TYPE_UNKNOWN;
+    file->oflags = FLAGS_RDONLY;
+    file->ref = 1;
+    buf_ra_reset(&file->ra);
+    spinlock_init(&file->lk, "file lock");
+    return file;
 }
 
 // 文件打开
@@ -52,6 +43,10 @@ ext4_file_t* ext4_file_open(char* path, ext4_inode_t* refer)
     if(ip == NULL) return NULL;
 
     ext4_file_t* file = ext4_file_alloc();
+    if(file == NULL) {
+        ext4_inode_put(ip);
+        return NULL;
+    }
     file->file_type = mode_to_type(ip->mode);
     file->ip = ip;
     file->off = 0;
@@ -64,23 +59,39 @@ void ext4_file_close(ext4_file_t* file)
 {
     spinlock_acquire(&file->lk);
     file->ref--;
-    if(file->ref == 0) {
-        if(file->file_type == TYPE_REGULAR || 
-           file->file_type == TYPE_DIRECTORY || 
-           file->file_type == TYPE_CHARDEV ||
-           file->file_type == TYPE_SYMLINK) {
-            ext4_inode_put(file->ip);
-        } else if(file->file_type == TYPE_FIFO) {
-            bool flag = true;
-            if((file->oflags & FLAGS_MASK) == FLAGS_RDONLY)
-                flag = false;
-            ext4_pipe_close(file->pipe, flag);
-        } else {
-            printf("file_type = %d\n", file->file_type);
-            panic("ext4_file_close: 0");
-        }
+    if(file->ref > 0) {
+        spinlock_release(&file->lk);
+        return;
+    }
+
+    if(file->file_type == TYPE_REGULAR || 
+       file->file_type == TYPE_DIRECTORY || 
+       file->file_type == TYPE_CHARDEV ||
+       file->file_type == TYPE_SYMLINK) {
+        ext4_inode_put(file->ip);
+    } else if(file->file_type == TYPE_FIFO) {
+        bool flag = true;
+        if((file->oflags & FLAGS_MASK) == FLAGS_RDONLY)
+            flag = false;
+        ext4_pipe_close(file->pipe, flag);
+    } else if(file->file_type == TYPE_UNKNOWN && file->ip == NULL && file->pipe == NULL) {
+        // 刚申请还没有关联inode或pipe的file (打开中途失败), 直接释放
+    } else {
+        printf("file_type = %d\n", file->file_type);
+        panic("ext4_file_close: 0");
     }
     spinlock_release(&file->lk);
+
+    // 没有人再引用这个file了
+    kmem_cache_free(ext4_file_cache, file);
+}
+
+// 是否可以走直接I/O: O_DIRECT打开的常规文件, 用户地址, 偏移/长度/地址都按扇区对齐
+// 不满足对齐要求时退回到缓存路径
+static bool direct_ok(ext4_file_t* file, uint64 addr, uint32 len, bool user)
+{
+    return (file->oflags & FLAGS_DIRECT) && user &&
+           file->off % SECTOR_SIZE == 0 && len % SECTOR_SIZE == 0 && addr % SECTOR_SIZE == 0;
 }
 
 // 文件内容读取
@@ -96,7 +107,19 @@ int ext4_file_read(ext4_file_t* file, uint64 dst, uint32 len, bool user_dst)
 
     if(file->file_type == TYPE_REGULAR) {  // 常规文件
         ext4_inode_lock(file->ip);
-        read_len = ext4_inode_read(file->ip, file->off, len, (void*)dst, user_dst);
+        if(direct_ok(file, dst, len, user_dst)) {
+            // 直接读入用户页, 剩余部分(用户页不可访问等)走缓存路径
+            read_len = ext4_inode_direct(file->ip, file->off, len, dst, false);
+            if(read_len < len && file->off + read_len < file->ip->size)
+                read_len += ext4_inode_read(file->ip, file->off + read_len, len - read_len, (void*)(dst + read_len), user_dst);
+        } else {
+            read_len = ext4_inode_read(file->ip, file->off, len, (void*)dst, user_dst);
+            // 顺序读取时预读后面的block
+            uint32 ra_off, ra_len;
+            ra_len = buf_ra_update(&file->ra, file->off, read_len, BLOCK_SIZE, &ra_off);
+            if(ra_len > 0)
+                ext4_inode_readahead(file->ip, ra_off, ra_len);
+        }
         ext4_inode_unlock(file->ip);
     } else if(file->file_type == TYPE_FIFO) { // pipe
         read_len = ext4_pipe_read(file->pipe, dst, len, user_dst);
@@ -125,7 +148,15 @@ int ext4_file_write(ext4_file_t* file, uint64 src, uint32 len, bool user_src)
 
     if(file->file_type == TYPE_REGULAR) {
         ext4_inode_lock(file->ip);
-        write_len = ext4_inode_write(file->ip, file->off, len, (void*)src, user_src);
+        if(direct_ok(file, src, len, user_src)) {
+            // 直接写已经分配的block, 需要扩充文件的部分走缓存路径
+            write_len = ext4_inode_direct(file->ip, file->off, len, src, true);
+            if(write_len < len)
+                write_len += ext4_inode_write(file->ip, file->off + write_len, len - write_len, (void*)(src + write_len), user_src);
+        } else {
+            write_len = ext4_inode_write(file->ip, file->off, len, (void*)src, user_src);
+        }
+        ext4_pcache_refresh(file->ip, file->off, write_len); // 映射了这段文件的进程看到新内容
         ext4_inode_unlock(file->ip);
     } else if(file->file_type == TYPE_FIFO) {
         write_len = ext4_pipe_write(file->pipe, src, len, user_src);
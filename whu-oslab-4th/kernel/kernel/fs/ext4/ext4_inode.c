@@ -2,9 +2,14 @@
 #include "fs/ext4_raw.h"
 #include "fs/ext4_inode.h"
 #include "fs/ext4_block.h"
+#include "fs/ext4_pcache.h"
 #include "fs/base_buf.h"
 #include "syscall/sysproc.h"
 #include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "proc/cpu.h"
+#include "dev/vio.h"
+#include "memlayout.h"
 #include "lib/str.h"
 #include "lib/print.h"
 
@@ -92,13 +97,13 @@ void ext4_inode_init(uint32 dev)
 	}
 }
 
-// 返回inode_table区域的一个sector序号
-// 这个sector包括序号为inum的inode
-static uint32 locate_sector(uint32 inum)
+// 返回inode_table区域的一个block序号
+// 这个block包括序号为inum的inode
+static uint32 locate_block(uint32 inum)
 {
 	int group = inum / ext4_sb.inode_per_group;
 	int offset = inum % ext4_sb.inode_per_group;
-	return ext4_gd[group].inode_table * SEC_PER_BLO + offset / INODE_PER_SEC;
+	return ext4_gd[group].inode_table + offset / INODE_PER_BLO;
 }
 
 // 使用磁盘中的inode更新内存中的 (读 inode table)
@@ -110,10 +115,10 @@ void ext4_inode_readback(ext4_inode_t* ip)
 	assert((ip->ref >= 1) && (ip->inum != 0), "ext4_inode_readback: 1");
 	
 	struct ext4_raw_inode *rip;
-	uint32 sector = locate_sector(ip->inum - 1);
-	uint32 offset = ((ip->inum - 1) % INODE_PER_SEC) * sizeof(struct ext4_raw_inode);
+	uint32 block = locate_block(ip->inum - 1);
+	uint32 offset = ((ip->inum - 1) % INODE_PER_BLO) * sizeof(struct ext4_raw_inode);
 
-	buf_t* buf = buf_read(ip->dev, sector);
+	buf_t* buf = ext4_block_buf(ip->dev, block);
 	rip = (struct ext4_raw_inode*)(buf->data + offset);
 
 	ip->mode = rip->i_mode;
@@ -132,10 +137,10 @@ void ext4_inode_writeback(ext4_inode_t* ip)
 	assert((ip->ref >= 1) && (ip->inum != 0), "ext4_inode_writeback: 1");
 
 	struct ext4_raw_inode *rip;
-	uint32 sector = locate_sector(ip->inum - 1);
-	uint32 offset = ((ip->inum -1) % INODE_PER_SEC) * sizeof(struct ext4_raw_inode);
+	uint32 block = locate_block(ip->inum - 1);
+	uint32 offset = ((ip->inum -1) % INODE_PER_BLO) * sizeof(struct ext4_raw_inode);
 
-	buf_t* buf = buf_read(ip->dev, sector);
+	buf_t* buf = ext4_block_buf(ip->dev, block);
 	rip = (struct ext4_raw_inode*)(buf->data + offset);
 
 	rip->i_mode = ip->mode;
@@ -180,6 +185,9 @@ void ext4_inode_put(ext4_inode_t* ip)
 		sleeplock_acquire(&ip->lk);
 		spinlock_release(&ext4_itable.lk);
 
+		// 释放页缓存 (文件还存在时写回脏页)
+		ext4_pcache_drop(ip);
+
 		// 磁盘里的删除
 		if(ip->nlink == 0)
 			ext4_inode_trunc(ip);
@@ -242,25 +250,24 @@ uint32 ext4_inode_inum_alloc(uint32 dev)
 	buf_t* buf;
 	
 	for(uint32 i = 0; i < NGROUP; i++) {
-		for(uint32 j = 0; j < SEC_PER_BLO; j++) {
- 			buf = buf_read(dev, ext4_gd[i].inode_bitmap * SEC_PER_BLO + j);
-			for(uint32 k = 0; k < SECTOR_SIZE; k++) {
-				mask = 1;
-				for(uint32 a = 0; ; a++) {
-					if( !(mask & buf->data[k]) ) {
-						// bitmap修改并写回 
-						buf->data[k] |= mask;
-						buf_write(buf);
-						buf_release(buf);
-						inum = (i * BLOCK_SIZE + j * SECTOR_SIZE + k) * 8 + a;
-						goto ret;
-					}
-					if(a == 7) break;
-					mask = mask << 1;
+		buf = ext4_block_buf(dev, ext4_gd[i].inode_bitmap);
+		for(uint32 k = 0; k < BLOCK_SIZE; k++) {
+			if(buf->data[k] == 0xFF) continue;
+			mask = 1;
+			for(uint32 a = 0; ; a++) {
+				if( !(mask & buf->data[k]) ) {
+					// bitmap修改并写回 
+					buf->data[k] |= mask;
+					buf_write(buf);
+					buf_release(buf);
+					inum = (i * BLOCK_SIZE + k) * 8 + a;
+					goto ret;
 				}
+				if(a == 7) break;
+				mask = mask << 1;
 			}
-			buf_release(buf);
-		}		
+		}
+		buf_release(buf);
 	}
 ret:
 	return inum + 1; // inum = 0 不使用
@@ -274,13 +281,11 @@ void ext4_inode_inum_free(uint32 dev, uint32 inum)
 	inum--;
 	uint32 i = inum / ext4_sb.inode_per_group;      // 隶属第i个group
 	uint32 j = inum % ext4_sb.inode_per_group;      // 在group内的第j个inode
-	uint32 a = j % (SECTOR_SIZE * 8);               // 在第b个sector里的第a个bit
-	uint32 b = j / (SECTOR_SIZE * 8);               // 属于第b个sector
+	uint32 a = j % (BLOCK_SIZE * 8);                // 在bitmap里的第a个bit
 	uint8  mask = 1 << (a % 8);
-	uint32 sector_num = ext4_gd[i].inode_bitmap * SEC_PER_BLO + b;
 	
 	assert(i < NGROUP, "ext4_inode_inum_free: -1");
-	buf_t* buf = buf_read(dev, sector_num);
+	buf_t* buf = ext4_block_buf(dev, ext4_gd[i].inode_bitmap);
 	assert(buf->data[a / 8] & mask, "ext4_inode_inum_free: 1");
 	buf->data[a / 8] = buf->data[a / 8] & (~mask);
 	buf_write(buf);
@@ -398,12 +403,23 @@ uint32 ext4_inode_read(ext4_inode_t* ip, uint32 off, uint32 len, void* dst, bool
 		
 		// 开始读取
 		uint32 block_start = (uint32)EXTENT_LEAF(ip->node.follow.el[entry]);
-		cut_len = min(left_len, BLOCK_SIZE - (off % BLOCK_SIZE));
-		for(uint16 offset = (uint16)(off / BLOCK_SIZE); offset < block_len; offset++) {
+		// 本次要读的多个block在磁盘上是连续的, 每RA_MAX个合并成一个请求
+		// 随着拷贝的推进预读下一批, 不一次锁住太多buf
+		uint32 first = off / BLOCK_SIZE;
+		uint32 nblock = min(block_len - first, (off % BLOCK_SIZE + left_len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+		uint32 ra_end = first; // [first, ra_end)已经发起预读
+		for(uint16 offset = (uint16)first; offset < block_len; offset++) {
+			if(nblock > 1 && offset == ra_end) {
+				uint32 n = min(first + nblock - ra_end, RA_MAX);
+				buf_prefetch_run(ip->dev, (block_start + ra_end) * SEC_PER_BLO, SEC_PER_BLO, n);
+				ra_end += n;
+			}
+			cut_len = min(left_len, BLOCK_SIZE - (off % BLOCK_SIZE));
 			read_len = ext4_block_read(ip->dev, block_start + (uint32)offset, off % BLOCK_SIZE, cut_len, dst, user_dst);
-			// 迭代
+			// 迭代 (只有第一个block可能从中间开始读)
 			left_len -= read_len;
 			dst += read_len;
+			off = 0;
 			if(read_len != cut_len) goto ret;
 			if(left_len == 0) goto ret;  
 		}
@@ -413,6 +429,114 @@ ret:
 	return len - left_len;
 }
 
+// 对文件区间[off, off+len)涉及的block发起预读
+// 调用者需要对ip上锁
+void ext4_inode_readahead(ext4_inode_t* ip, uint32 off, uint32 len)
+{
+	assert(sleeplock_holding(&ip->lk), "ext4_inode_readahead: 0");
+	if(ip->node.eh.depth != 0 || off >= ip->size || len == 0) return;
+
+	len = min(len, ip->size - off);
+	uint32 first = off / BLOCK_SIZE;             // 第一个逻辑块号
+	uint32 last  = (off + len - 1) / BLOCK_SIZE; // 最后一个逻辑块号
+	uint32 lblock = 0;                           // 当前entry的第一个逻辑块号
+
+	for(uint16 entry = 0; entry < ip->node.eh.entries && lblock <= last; entry++)
+	{
+		uint32 block_len = ip->node.follow.el[entry].len;
+		uint32 block_start = (uint32)EXTENT_LEAF(ip->node.follow.el[entry]);
+		uint32 begin = max(first, lblock);
+		uint32 end = min(last + 1, lblock + block_len);
+		if(begin < end) // extent内的block是连续的, 合并成scatter-gather请求
+			buf_prefetch_run(ip->dev, (block_start + begin - lblock) * SEC_PER_BLO, SEC_PER_BLO, end - begin);
+		lblock += block_len;
+	}
+}
+
+// 直接I/O的用户页: 返回va对应的物理地址, 不可访问时返回0
+// 读文件时设备要写这个页, 所以还要求页可写
+static uint64 direct_getpa(pgtbl_t pagetable, uint64 va, bool write)
+{
+	int level;
+	pte_t* pte = vm_getleaf(pagetable, va, &level);
+	if(pte == NULL) return 0;
+	if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0) return 0;
+	if(!write && (*pte & PTE_W) == 0) return 0;
+	if(!write) *pte |= PTE_D; // 设备写入用户页, 共享文件映射的页要当作脏页
+	return PTE_TO_PA(*pte) + va % VM_LEVEL_SIZE(level);
+}
+
+// 直接I/O: 在文件[off, off+len)和用户地址uaddr之间传输, 不经过buf缓存
+// 数据段直接指向用户页的物理地址, 每个请求覆盖磁盘上连续的一段
+// off, len, uaddr需要按SECTOR_SIZE对齐, 只访问已经分配的block
+// 返回传输的字节数, 遇到不可访问的用户页时提前返回 (剩余部分由调用者走缓存路径)
+// 调用者需要对ip上锁
+uint32 ext4_inode_direct(ext4_inode_t* ip, uint32 off, uint32 len, uint64 uaddr, bool write)
+{
+	assert(sleeplock_holding(&ip->lk), "ext4_inode_direct: 0");
+	assert(ip->node.eh.depth == 0, "ext4_inode_direct: 1");
+	assert(off % SECTOR_SIZE == 0 && len % SECTOR_SIZE == 0 && uaddr % SECTOR_SIZE == 0, "ext4_inode_direct: 2");
+
+	uint32 total = len;
+	if(!write) { // 读到文件末尾所在的扇区为止
+		if(off >= ip->size) return 0;
+		total = min(len, ALIGN_UP(ip->size - off, SECTOR_SIZE));
+	}
+
+	pgtbl_t pagetable = myproc()->pagetable;
+	uint32 done = 0;
+	uint64 lblock = 0; // 当前entry的第一个逻辑块号
+	for(uint16 entry = 0; entry < ip->node.eh.entries && done < total; entry++)
+	{
+		uint32 block_len = ip->node.follow.el[entry].len;
+		uint64 block_start = EXTENT_LEAF(ip->node.follow.el[entry]);
+		uint64 ext_end = (lblock + block_len) * BLOCK_SIZE; // 这个extent覆盖的文件偏移上界
+
+		while(done < total && off + done < ext_end) {
+			uint64 pos = off + done;
+			uint64 sector = block_start * SEC_PER_BLO + (pos - lblock * BLOCK_SIZE) / SECTOR_SIZE;
+			uint32 want = min(total - done, ext_end - pos);
+
+			// 收集用户页, 物理地址相邻的页合并成一个段
+			vio_seg_t segs[VIO_SEG_MAX];
+			int n = 0;
+			uint32 got = 0;
+			while(got < want) {
+				uint64 va = uaddr + done + got;
+				uint32 chunk = min(want - got, PAGE_SIZE - va % PAGE_SIZE);
+				uint64 pa = direct_getpa(pagetable, va, write);
+				if(pa == 0) break;
+				if(n > 0 && segs[n-1].addr + segs[n-1].len == pa) {
+					segs[n-1].len += chunk;
+				} else {
+					if(n == VIO_SEG_MAX) break;
+					segs[n].addr = pa;
+					segs[n].len = chunk;
+					n++;
+				}
+				got += chunk;
+			}
+			if(got == 0) goto ret;
+
+			// 缓存里可能有这些扇区: 读之前写回dirty的, 写之前使其失效
+			buf_sync_range(ip->dev, sector, got / SECTOR_SIZE, write);
+			virtio_disk_rw_direct(sector, segs, n, write);
+			done += got;
+		}
+		lblock += block_len;
+	}
+
+ret:
+	if(write) {
+		if((ip->mode & IMODE_MASK) == IMODE_FILE && off + done > ip->size) {
+			ip->size = off + done;
+			ext4_inode_writeback(ip);
+		}
+		return done;
+	}
+	return min(done, ip->size - off);
+}
+
 // 通过inode里的信息修改文件内容
 // 调用者需要对ip上锁
 // (可能搞不定追加写)
@@ -421,7 +545,7 @@ uint32 ext4_inode_write(ext4_inode_t* ip, uint32 off, uint32 len, void* src, boo
 	assert(sleeplock_holding(&ip->lk), "ext4_inode_write: 0");
 	assert(ip->node.eh.depth == 0, "ext4_inode_write: 0");
 
-	uint32 write_len, cut_len, left_len = len;
+	uint32 write_len, cut_len, left_len = len, start = off;
 	for(uint16 entry = 0; entry < ip->node.eh.entries; entry++) // 遍历每个entry
 	{
 		// printf("----------ip->size = %d\n", ip->size);
@@ -439,8 +563,6 @@ uint32 ext4_inode_write(ext4_inode_t* ip, uint32 off, uint32 len, void* src, boo
 			// 迭代
 			left_len -= write_len;
 			src      += write_len;
-			if((ip->mode & IMODE_MASK) == IMODE_FILE)
-				ip->size += write_len;
 			if(write_len != cut_len) goto ret;
 			if(left_len == 0) goto ret;
 		}
@@ -467,11 +589,15 @@ uint32 ext4_inode_write(ext4_inode_t* ip, uint32 off, uint32 len, void* src, boo
 		// 迭代
 		left_len -= write_len;
 		src      += write_len;
-		ip->size += write_len;
+		if((ip->mode & IMODE_MASK) != IMODE_FILE)
+			ip->size += write_len;
 	}
 	// printf("----------ip->size = %d\n", ip->size);
 ret:
 	// printf("----------ip->size = %d\n", ip->size);
+	// 普通文件: 写到了原来的末尾之后才变大 (覆盖写不改变大小)
+	if((ip->mode & IMODE_MASK) == IMODE_FILE && start + len - left_len > ip->size)
+		ip->size = start + len - left_len;
 	// 写回修改后的inode
 	ext4_inode_writeback(ip);
 	return len - left_len;
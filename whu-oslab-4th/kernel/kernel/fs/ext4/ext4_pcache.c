@@ -0,0 +1,286 @@
+#include "fs/ext4_pcache.h"
+#include "fs/ext4_inode.h"
+#include "mem/pmem.h"
+#include "mem/slab.h"
+#include "lib/print.h"
+#include "memlayout.h"
+
+/*
+    ext4的页缓存: 文件mmap按需从这里映射4K页
+    (inode, index) -> 物理页, 哈希表查找, 同时挂在inode的页链表和全局LRU上
+
+    物理页的引用计数(pmem_dup_pages)表示被映射的次数, 页缓存本身持有基础引用
+    MAP_SHARED的映射直接指向缓存页, MAP_PRIVATE只读映射缓存页, 写时复制
+    没有被映射(pmem_shared为false)的干净页可以回收
+
+    读入/写回都要持有inode的睡眠锁, 链表和计数由pcache.lk保护
+    脏页在msync/munmap/inode释放时写回, 被解除映射的页在那时已经写回过
+    所以回收时只挑干净页, 不需要再拿其他inode的锁
+*/
+
+static struct {
+    spinlock_t lk;
+    ext4_page_t* hash[EXT4_PCACHE_NHASH];
+    ext4_page_t lru;           // 哨兵: lru.lru_next最近使用, lru.lru_prev最久未使用
+    pcache_stat_t st;
+} pcache;
+
+static kmem_cache_t* ext4_page_cache; // ext4_page_t的slab cache
+
+// 页缓存初始化(单核执行)
+void ext4_pcache_init(void)
+{
+    spinlock_init(&pcache.lk, "ext4_pcache");
+    pcache.lru.lru_next = pcache.lru.lru_prev = &pcache.lru;
+    ext4_page_cache = kmem_cache_create("ext4_page", sizeof(ext4_page_t));
+}
+
+static inline ext4_page_t** pcache_bucket(ext4_inode_t* ip, uint32 index)
+{
+    return &pcache.hash[((uint64)ip / sizeof(ext4_inode_t) + index) % EXT4_PCACHE_NHASH];
+}
+
+static inline void lru_del(ext4_page_t* pg)
+{
+    pg->lru_prev->lru_next = pg->lru_next;
+    pg->lru_next->lru_prev = pg->lru_prev;
+}
+
+static inline void lru_push(ext4_page_t* pg)
+{
+    pg->lru_next = pcache.lru.lru_next;
+    pg->lru_prev = &pcache.lru;
+    pcache.lru.lru_next->lru_prev = pg;
+    pcache.lru.lru_next = pg;
+}
+
+// 查找缓存页, 调用者持有pcache.lk
+static ext4_page_t* pcache_lookup(ext4_inode_t* ip, uint32 index)
+{
+    ext4_page_t* pg;
+    for(pg = *pcache_bucket(ip, index); pg != NULL; pg = pg->hnext)
+        if(pg->ip == ip && pg->index == index)
+            break;
+    return pg;
+}
+
+// 把pg移出哈希表/inode链表/LRU, 调用者持有pcache.lk
+static void pcache_unlink(ext4_page_t* pg)
+{
+    ext4_page_t** pp = pcache_bucket(pg->ip, pg->index);
+    while(*pp != pg)
+        pp = &(*pp)->hnext;
+    *pp = pg->hnext;
+
+    if(pg->iprev) pg->iprev->inext = pg->inext;
+    else pg->ip->pages = pg->inext;
+    if(pg->inext) pg->inext->iprev = pg->iprev;
+
+    lru_del(pg);
+    if(pg->dirty) pcache.st.ndirty--;
+    pcache.st.npages--;
+}
+
+// 释放移出缓存的页
+static void pcache_free(ext4_page_t* pg)
+{
+    pmem_free_pages((void*)pg->pa, 1, false);
+    kmem_cache_free(ext4_page_cache, pg);
+}
+
+// 缓存页超过上限时, 从LRU尾部回收一批没有被映射的干净页
+static void pcache_shrink(void)
+{
+    ext4_page_t *pg, *prev, *victims = NULL;
+    int n = 0;
+
+    spinlock_acquire(&pcache.lk);
+    for(pg = pcache.lru.lru_prev; pg != &pcache.lru && n < 32; pg = prev) {
+        prev = pg->lru_prev;
+        if(pcache.st.npages <= EXT4_PCACHE_MAX) break;
+        if(pg->dirty || pmem_shared((void*)pg->pa, 1)) continue;
+        pcache_unlink(pg);
+        pg->hnext = victims;
+        victims = pg;
+        pcache.st.nevict++;
+        n++;
+    }
+    spinlock_release(&pcache.lk);
+
+    while(victims) {
+        pg = victims;
+        victims = pg->hnext;
+        pcache_free(pg);
+    }
+}
+
+/*
+    获得ip的第index个4K页 (文件偏移index*4K), 不在缓存中时从文件读入
+    文件末尾之后的部分是0
+    返回物理页, 调用者多持有一次引用(用于映射, 不用时pmem_free_pages)
+    major表示是否读了文件, 内存不足返回0
+    调用者需要对ip上锁
+*/
+uint64 ext4_pcache_get(ext4_inode_t* ip, uint32 index, bool* major)
+{
+    assert(sleeplock_holding(&ip->lk), "ext4_pcache_get: 0");
+    ext4_page_t* pg;
+
+    *major = false;
+    spinlock_acquire(&pcache.lk);
+    pg = pcache_lookup(ip, index);
+    if(pg != NULL) {
+        lru_del(pg);
+        lru_push(pg);
+        pmem_dup_pages((void*)pg->pa, 1);
+        pcache.st.nhit++;
+        spinlock_release(&pcache.lk);
+        return pg->pa;
+    }
+    spinlock_release(&pcache.lk);
+
+    // 不在缓存中: 持有ip->lk, 其他进程不会同时读入这一页
+    if(pcache.st.npages > EXT4_PCACHE_MAX)
+        pcache_shrink();
+    pg = kmem_cache_alloc(ext4_page_cache);
+    if(pg == NULL) return 0;
+    void* mem = pmem_alloc_zeroed(false);
+    if(mem == NULL) {
+        kmem_cache_free(ext4_page_cache, pg);
+        return 0;
+    }
+    uint64 off = (uint64)index * PAGE_SIZE;
+    if(off < ip->size)
+        ext4_inode_read(ip, (uint32)off, PAGE_SIZE, mem, false);
+    *major = true;
+
+    pg->ip = ip;
+    pg->index = index;
+    pg->pa = (uint64)mem;
+    pg->dirty = false;
+
+    spinlock_acquire(&pcache.lk);
+    ext4_page_t** bucket = pcache_bucket(ip, index);
+    pg->hnext = *bucket;
+    *bucket = pg;
+    pg->iprev = NULL;
+    pg->inext = ip->pages;
+    if(ip->pages) ip->pages->iprev = pg;
+    ip->pages = pg;
+    lru_push(pg);
+    pmem_dup_pages(mem, 1);
+    pcache.st.npages++;
+    pcache.st.nmiss++;
+    spinlock_release(&pcache.lk);
+
+    return pg->pa;
+}
+
+// 标记ip的第index页为脏页 (共享映射的页被写过)
+void ext4_pcache_dirty(ext4_inode_t* ip, uint32 index)
+{
+    spinlock_acquire(&pcache.lk);
+    ext4_page_t* pg = pcache_lookup(ip, index);
+    if(pg != NULL && !pg->dirty) {
+        pg->dirty = true;
+        pcache.st.ndirty++;
+    }
+    spinlock_release(&pcache.lk);
+}
+
+/*
+    把ip的第[first, last]页中的脏页写回文件
+    只写文件大小以内的部分, 不会扩充文件
+    调用者需要对ip上锁
+*/
+void ext4_pcache_writeback(ext4_inode_t* ip, uint32 first, uint32 last)
+{
+    assert(sleeplock_holding(&ip->lk), "ext4_pcache_writeback: 0");
+    ext4_page_t* pg;
+
+    while(1) {
+        spinlock_acquire(&pcache.lk);
+        for(pg = ip->pages; pg != NULL; pg = pg->inext)
+            if(pg->dirty && pg->index >= first && pg->index <= last)
+                break;
+        if(pg == NULL) {
+            spinlock_release(&pcache.lk);
+            break;
+        }
+        pg->dirty = false;
+        pcache.st.ndirty--;
+        pcache.st.nwriteback++;
+        uint64 pa = pg->pa;
+        uint64 off = (uint64)pg->index * PAGE_SIZE;
+        pmem_dup_pages((void*)pa, 1); // 写回期间不能被回收
+        spinlock_release(&pcache.lk);
+
+        if(off < ip->size)
+            ext4_inode_write(ip, (uint32)off, min(PAGE_SIZE, ip->size - off), (void*)pa, false);
+        pmem_free_pages((void*)pa, 1, false);
+    }
+}
+
+/*
+    write系统调用修改了文件[off, off+len)之后调用
+    把这段内容重新读入已经缓存的页, 使映射看到新的数据
+    调用者需要对ip上锁
+*/
+void ext4_pcache_refresh(ext4_inode_t* ip, uint32 off, uint32 len)
+{
+    assert(sleeplock_holding(&ip->lk), "ext4_pcache_refresh: 0");
+    if(len == 0 || ip->pages == NULL) return;
+
+    uint64 end = (uint64)off + len;
+    for(uint64 index = off / PAGE_SIZE; index * PAGE_SIZE < end; index++) {
+        spinlock_acquire(&pcache.lk);
+        ext4_page_t* pg = pcache_lookup(ip, (uint32)index);
+        uint64 pa = pg ? pg->pa : 0;
+        if(pa) pmem_dup_pages((void*)pa, 1);
+        spinlock_release(&pcache.lk);
+        if(pa == 0) continue;
+
+        uint64 begin = max(index * PAGE_SIZE, (uint64)off);
+        uint64 stop = min((index + 1) * PAGE_SIZE, end);
+        ext4_inode_read(ip, (uint32)begin, stop - begin, (void*)(pa + begin % PAGE_SIZE), false);
+        pmem_free_pages((void*)pa, 1, false);
+    }
+}
+
+/*
+    inode不再被使用时释放它的所有缓存页 (文件还存在时先写回脏页)
+    这时已经没有映射了 (每个文件映射区域都持有inode的引用)
+    调用者需要对ip上锁
+*/
+void ext4_pcache_drop(ext4_inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->lk), "ext4_pcache_drop: 0");
+    ext4_page_t *pg, *victims = NULL;
+
+    if(ip->pages == NULL) return;
+    if(ip->nlink > 0)
+        ext4_pcache_writeback(ip, 0, 0xFFFFFFFF);
+
+    spinlock_acquire(&pcache.lk);
+    while((pg = ip->pages) != NULL) {
+        assert(!pmem_shared((void*)pg->pa, 1), "ext4_pcache_drop: 1");
+        pcache_unlink(pg);
+        pg->hnext = victims;
+        victims = pg;
+    }
+    spinlock_release(&pcache.lk);
+
+    while(victims) {
+        pg = victims;
+        victims = pg->hnext;
+        pcache_free(pg);
+    }
+}
+
+// 页缓存的统计信息
+void ext4_pcache_stat(pcache_stat_t* st)
+{
+    spinlock_acquire(&pcache.lk);
+    *st = pcache.st;
+    spinlock_release(&pcache.lk);
+}
@@ -3,20 +3,38 @@
 #include "proc/cpu.h"
 #include "mem/pmem.h"
 #include "mem/vmem.h"
+#include "mem/slab.h"
 #include "lib/print.h"
 
+static kmem_cache_t* ext4_pipe_cache; // pipe对象的slab cache
+
+// pipe cache初始化(单核执行)
+void ext4_pipe_init()
+{
+    ext4_pipe_cache = kmem_cache_create("ext4_pipe", sizeof(ext4_pipe_t));
+}
+
+// 存在的pipe数 (用于内存统计)
+uint32 ext4_pipe_count(void)
+{
+    return ext4_pipe_cache ? kmem_cache_inuse(ext4_pipe_cache) : 0;
+}
+
 // 申请一个pipe
 // 需要传入两个文件指针作为pipe的输入端口和输出端口
 // 成功返回0 失败返回-1
 int ext4_pipe_alloc(ext4_file_t** read, ext4_file_t** write)
 {
-    ext4_pipe_t* pi = (ext4_pipe_t*)pmem_alloc_pages(1, true);
-    if(pi == NULL) {
-        pmem_free_pages(pi, 1, true);
-        return -1;
-    }
+    ext4_pipe_t* pi = kmem_cache_alloc(ext4_pipe_cache);
+    if(pi == NULL) return -1;
     *read = ext4_file_alloc();
     *write = ext4_file_alloc();
+    if(*read == NULL || *write == NULL) {
+        if(*read != NULL) ext4_file_close(*read);
+        if(*write != NULL) ext4_file_close(*write);
+        kmem_cache_free(ext4_pipe_cache, pi);
+        return -1;
+    }
 
     spinlock_init(&pi->lk, "pipe");
     pi->readable = true;
@@ -50,7 +68,7 @@ void ext4_pipe_close(ext4_pipe_t* pi, bool write_port)
     // 如果都关闭了,释放pipe
     if(pi->readable == false && pi->writeable == false) {
         spinlock_release(&pi->lk);
-        pmem_free_pages(pi, 1, true);
+        kmem_cache_free(ext4_pipe_cache, pi);
     } else {    
         spinlock_release(&pi->lk);
     }
@@ -273,6 +273,10 @@ uint64 ext4_sys_openat(int fd, char* path, int flags, uint16 mode)
     /* 到此获得了一个上了锁的inode */
     
     file = ext4_file_alloc();
+    if(file == NULL) {
+        ext4_inode_unlockput(ip);
+        return -1;
+    }
     
     file->ip = ip;
     file->off = 0;
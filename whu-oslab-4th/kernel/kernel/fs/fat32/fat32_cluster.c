@@ -7,6 +7,7 @@
 #include "fs/base_buf.h"
 #include "fs/fat32_cluster.h"
 #include "mem/vmem.h"
+#include "mem/pmem.h"
 #include "proc/cpu.h"
 #include "lib/str.h"
 #include "lib/print.h"
@@ -34,6 +35,19 @@ static inline uint32 cluster_firstSector(uint32 cluster)
     return (cluster - sb.root_cluster) * sb.sector_per_cluster + sb.first_data_sector;
 }
 
+// 数据区buf的字节数: 一个簇(超过BLOCK_SIZE时按BLOCK_SIZE切分)
+static inline uint32 chunk_bytes(void)
+{
+    return min(sb.byte_per_cluster, BLOCK_SIZE);
+}
+
+// 读入目标簇的第i个数据块(一个buf, 一次virtio请求)
+static inline buf_t* cluster_chunk(uint32 dev, uint32 cluster, uint32 i)
+{
+    uint32 nsec = chunk_bytes() / sb.byte_per_sector;
+    return buf_read_nsec(dev, cluster_firstSector(cluster) + i * nsec, nsec);
+}
+
 /*----------------------------------- 接口函数 --------------------------------------*/
 
 // 根据当前的cluster编号找到下一个cluster的编号(读取FAT表)
@@ -67,11 +81,11 @@ int fat32_cluster_changeNextCluster(uint32 dev, uint32 cluster, uint32 new_clust
 void fat32_cluster_clear(uint32 dev, uint32 cluster)
 {
     buf_t* buf;
-    uint32 fisrt_sector = cluster_firstSector(cluster);
-    // 逐个清空扇区即可
-    for(int i=0; i<sb.sector_per_cluster; i++) {
-        buf = buf_read(dev, fisrt_sector + i);
-        memset(buf->data, 0, SECTOR_SIZE);
+    uint32 chunk = chunk_bytes();
+    // 逐个清空数据块即可
+    for(uint32 i = 0; i < sb.byte_per_cluster / chunk; i++) {
+        buf = cluster_chunk(dev, cluster, i);
+        memset(buf->data, 0, chunk);
         buf_write(buf);
         buf_release(buf);
     }
@@ -113,6 +127,14 @@ void fat32_cluster_free(uint32 dev, uint32 cluster)
     assert(ret == 0, "fat32_cluster_free");
 }
 
+// 把cluster的数据预读进缓存 (最多RA_MAX个数据块)
+void fat32_cluster_prefetch(uint32 dev, uint32 cluster)
+{
+    uint32 chunk = chunk_bytes();
+    uint32 nsec = chunk / sb.byte_per_sector;
+    buf_prefetch_run(dev, cluster_firstSector(cluster), nsec, sb.byte_per_cluster / chunk);
+}
+
 // 从cluster中读入数据 [offset, offset+len) 放置到内存dst位置处
 // 其中user_dst用于标记地址是否是用户态的
 // 返回实际读入的字节数
@@ -122,19 +144,28 @@ uint32 fat32_cluster_read(uint32 dev, uint32 cluster, uint32 offset, uint32 len,
     assert(offset < sb.byte_per_cluster, "fat32_cluster_read: 1\n");         // offset溢出检查 
     
     uint32 tot_len = 0, cut_len = 0; // 总共实际迁移的字节数, 单次实际迁移的字节数
-    uint32 first_sector = cluster_firstSector(cluster);
+    uint32 chunk = chunk_bytes();
     buf_t* buf;
     int ret = 0;
 
-    for(int i = 0; i < sb.sector_per_cluster; i++) {
-        if(offset >= sb.byte_per_sector) {
-            offset -= sb.byte_per_sector;
-            continue;
+    // 簇内要读的多个数据块在磁盘上是连续的, 每RA_MAX个合并成一个请求
+    // 随着拷贝的推进预读下一批, 不一次锁住太多buf
+    uint32 nsec = chunk / sb.byte_per_sector;
+    uint32 first = offset / chunk;
+    uint32 nchunk = min(sb.byte_per_cluster / chunk - first, (offset % chunk + len + chunk - 1) / chunk);
+    uint32 ra_end = first; // [first, ra_end)已经发起预读
+
+    for(uint32 i = first; i < sb.byte_per_cluster / chunk; i++) {
+        if(nchunk > 1 && i == ra_end) {
+            uint32 n = min(first + nchunk - ra_end, RA_MAX);
+            buf_prefetch_run(dev, cluster_firstSector(cluster) + ra_end * nsec, nsec, n);
+            ra_end += n;
         }
+        offset = offset % chunk;
         // 确定迁移字节数
-        cut_len = min(len, sb.byte_per_sector - offset % sb.byte_per_sector); 
+        cut_len = min(len, chunk - offset); 
         // 读入
-        buf = buf_read(dev, first_sector + i); 
+        buf = cluster_chunk(dev, cluster, i); 
         // 数据迁移
         ret = vm_copyout(user_dst, dst, (buf->data + offset), cut_len);
         buf_release(buf);
@@ -159,24 +190,27 @@ uint32 fat32_cluster_write(uint32 dev, uint32 cluster, uint32 offset, uint32 len
     assert(offset < sb.byte_per_cluster, "fat32_cluster_write: 1\n");        // offset溢出检查
     
     uint32 tot_len = 0, cut_len = 0; // 总共实际迁移的字节数, 单次实际迁移的字节数
-    uint32 first_sector = cluster_firstSector(cluster);
+    uint32 chunk = chunk_bytes();
     buf_t* buf;
-    int ret = 0;
+    void* tmp = NULL;
 
-    for(int i = 0; i < sb.sector_per_cluster; i++) {
-        if(offset >= sb.byte_per_sector) {
-            offset -= sb.byte_per_sector;
-            continue;
-        }
+    // 用户数据先拷到临时页再进buf, 拷贝失败时buf里不会留下写了一半的数据
+    if(user_src && (tmp = pmem_alloc_pages(1, true)) == NULL)
+        return 0;
+
+    for(uint32 i = offset / chunk; i < sb.byte_per_cluster / chunk; i++) {
+        offset = offset % chunk;
         // 确定迁移字节数
-        cut_len = min(len, sb.byte_per_sector - offset % sb.byte_per_sector); 
+        cut_len = min(len, chunk - offset); 
+        // 用户数据拷入临时页, 失败退出(buf还没动过)
+        if(user_src && vm_copyin(true, tmp, src, cut_len) == -1)
+            break;
         // 读入
-        buf = buf_read(dev, first_sector + i); 
+        buf = cluster_chunk(dev, cluster, i); 
         // 数据迁移
-        ret = vm_copyin(user_src, (buf->data + offset), src, cut_len);
+        memmove(buf->data + offset, user_src ? tmp : (void*)src, cut_len);
         buf_write(buf);
         buf_release(buf);
-        if(ret == -1) break; // 失败退出
         // 迭代
         offset = 0;
         len -= cut_len;
@@ -184,5 +218,8 @@ uint32 fat32_cluster_write(uint32 dev, uint32 cluster, uint32 offset, uint32 len
         tot_len += cut_len;
         if(len == 0) break; // 成功退出
     }
+
+    if(tmp != NULL)
+        pmem_free_pages(tmp, 1, true);
     return tot_len;
 }
\ No newline at end of file
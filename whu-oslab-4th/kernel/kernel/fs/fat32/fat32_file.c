@@ -4,40 +4,34 @@
 #include "lib/print.h"
 #include "proc/cpu.h"
 #include "mem/vmem.h"
+#include "mem/slab.h"
 
 // 设备列表
 fat32_dev_t fat32_devlist[NDEV];
 
-// 文件列表
+// 文件表: 文件对象由slab cache分配, lk保护引用计数
 static struct {
     spinlock_t lk;
-    fat32_file_t files[NFILE];
+    kmem_cache_t* cache;
 } ftable;
 
-// 初始化文件列表ftable
+// 初始化文件表ftable
 void fat32_file_init(void)
 {
     spinlock_init(&ftable.lk, "filetable");
-    for(fat32_file_t* file = ftable.files; file < &ftable.files[NFILE]; file++) {
-        file->type = FD_NODE;
-        file->ref = 0;
-    }
+    ftable.cache = kmem_cache_create("fat32_file", sizeof(fat32_file_t));
+    fat32_pipe_init();
     // printf("fat32_file_init success!\n");
 }
 
-// 返回一个空闲的file
+// 返回一个新的file
 fat32_file_t* fat32_file_alloc(void)
 {
-    fat32_file_t* f;
-    spinlock_acquire(&ftable.lk);
-    for(f = ftable.files; f < &ftable.files[NFILE]; f++) {
-        if(f->ref == 0) {
-            f->ref = 1;
-            break;
-        }
-    }
-    spinlock_release(&ftable.lk);
-    assert(f < &ftable.files[NFILE], "fat32_file_alloc");
+    fat32_file_t* f = kmem_cache_zalloc(ftable.cache);
+    assert(f != NULL, "fat32_file_alloc");
+    f->type = FD_NODE;
+    f->ref = 1;
+    buf_ra_reset(&f->ra);
     return f;
 }
 
@@ -52,8 +46,8 @@ void fat32_file_close(fat32_file_t* file)
     file->ref--;
     if(file->ref == 0) {
         fat32_file_t ff = *file;
-        file->type = FD_NODE;
         spinlock_release(&ftable.lk);
+        kmem_cache_free(ftable.cache, file);
         // 释放过程,这是一个耗时操作,应当放在临界区外
         if(ff.type == FD_PIPE) {
             fat32_pipe_close(ff.pipe, ff.writable);
@@ -86,6 +80,11 @@ int fat32_file_read(fat32_file_t* f, uint64 va, int n)
         case FD_INODE:         // 读取inode文件
             fat32_inode_lock(f->ip);
             ret = fat32_inode_read(f->ip, f->off, n, va, true);
+            // 顺序读取时预读后面的簇
+            uint32 ra_off, ra_len;
+            ra_len = buf_ra_update(&f->ra, f->off, ret, BLOCK_SIZE, &ra_off);
+            if(ra_len > 0)
+                fat32_inode_readahead(f->ip, ra_off, ra_len);
             fat32_inode_unlock(f->ip);
             f->off += ret;
             break;
@@ -133,6 +133,31 @@ int fat32_inode_read(fat32_inode_t* ip, uint32 off, uint32 len, uint64 dst, bool
     return tot_len;
 }
 
+// 对文件区间[off, off+len)涉及的簇发起预读
+// 注意：调用者需持有ip锁
+void fat32_inode_readahead(fat32_inode_t* ip, uint32 off, uint32 len)
+{
+    if(ip->attribute & ATTR_DIRECTORY) return;
+    if(off >= ip->file_size || len == 0) return;
+
+    len = min(len, ip->file_size - off);
+    uint32 first = off / sb.byte_per_cluster;             // 文件内第一个簇的序号
+    uint32 last  = (off + len - 1) / sb.byte_per_cluster; // 文件内最后一个簇的序号
+    uint32 clus  = ip->first_clus;
+
+    // 沿着FAT链表走到第一个簇 (FAT表扇区一般已在缓存中)
+    for(uint32 i = 0; i < first; i++) {
+        clus = fat32_cluster_getNextCluster(ip->dev, clus);
+        if(clus == 0 || clus >= 0x0FFFFFF8) return;
+    }
+    for(uint32 i = first; i <= last; i++) {
+        fat32_cluster_prefetch(ip->dev, clus);
+        if(i == last) break;
+        clus = fat32_cluster_getNextCluster(ip->dev, clus);
+        if(clus == 0 || clus >= 0x0FFFFFF8) return;
+    }
+}
+
 // 向ip管理的文件写入内容
 // 数据流: src => ip->filedata[off, off+len)
 // user_src用于标记src是否属于用户地址空间
@@ -2,16 +2,33 @@
 #include "fs/fat32_file.h"
 #include "mem/pmem.h"
 #include "mem/vmem.h"
+#include "mem/slab.h"
 #include "proc/cpu.h"
 #include "lib/print.h"
 
+static kmem_cache_t* pipe_cache; // pipe对象的slab cache
+
+// pipe cache初始化(单核执行)
+void fat32_pipe_init(void)
+{
+    pipe_cache = kmem_cache_create("fat32_pipe", sizeof(pipe_t));
+}
+
+// 存在的pipe数 (用于内存统计)
+uint32 fat32_pipe_count(void)
+{
+    return pipe_cache ? kmem_cache_inuse(pipe_cache) : 0;
+}
+
 // 申请一个pipe
 // 需要传入两个文件指针作为pipe的输入端口和输出端口(type = FD_PIPE)
 // 成功返回0 失败返回-1
 int fat32_pipe_alloc(fat32_file_t** read, fat32_file_t** write)
 {
-    // 尝试申请地址空间
-    pipe_t* pi = (pipe_t*)pmem_alloc_pages(1, true);
+    *read = *write = NULL;
+
+    // 尝试申请pipe对象
+    pipe_t* pi = kmem_cache_alloc(pipe_cache);
     if(pi == NULL) goto fail;
     *read = fat32_file_alloc();
     if(*read == NULL) goto fail;
@@ -39,7 +56,7 @@ int fat32_pipe_alloc(fat32_file_t** read, fat32_file_t** write)
     return 0;
 
 fail:
-    if(pi) pmem_free_pages(pi, 1, true);
+    if(pi) kmem_cache_free(pipe_cache, pi);
     if(*read) fat32_file_close(*read);
     if(*write) fat32_file_close(*write);
     return -1;
@@ -61,7 +78,7 @@ void fat32_pipe_close(pipe_t* pi, bool writeable)
     // 如果都关闭了,释放pipe
     if(pi->readable == false && pi->writeable == false) {
         spinlock_release(&pi->lk);
-        pmem_free_pages(pi, 1, true);
+        kmem_cache_free(pipe_cache, pi);
     } else {    
         spinlock_release(&pi->lk);
     }
@@ -1,8 +1,16 @@
 #include "fs/procfs.h"
 #include "dev/timer.h"
 #include "dev/rtc.h"
+#include "dev/vio.h"
 #include "mem/pmem.h"
+#include "mem/slab.h"
+#include "mem/vmem.h"
+#include "fs/base_buf.h"
+#include "fs/ext4_pipe.h"
+#include "fs/ext4_pcache.h"
+#include "fs/fat32_pipe.h"
 #include "proc/proc.h"
+#include "proc/cpu.h"
 #include "lib/str.h"
 #include "lib/print.h"
 
@@ -10,20 +18,197 @@
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 #endif
 
+// 在content末尾追加一行 "name value\n" (没有snprintf)
+static void append_num(char* content, const char* name, uint64 val)
+{
+    char num[24];
+    int i = sizeof(num) - 1;
+    num[i] = '\0';
+    do {
+        num[--i] = '0' + val % 10;
+        val /= 10;
+    } while(val > 0);
+    strcat(content, name);
+    strcat(content, &num[i]);
+    strcat(content, "\n");
+}
+
+// 在content末尾追加右对齐到width宽度的数字
+static void append_pad(char* content, uint64 val, int width)
+{
+    char num[24];
+    int i = sizeof(num) - 1;
+    num[i] = '\0';
+    do {
+        num[--i] = '0' + val % 10;
+        val /= 10;
+    } while(val > 0);
+    while(sizeof(num) - 1 - i < width && i > 0)
+        num[--i] = ' ';
+    strcat(content, &num[i]);
+}
+
+// 读取/proc/buddyinfo (各阶空闲块数量)
+static int read_proc_buddyinfo(char* buf, int size, int offset)
+{
+    char content[512];
+    pmem_stat_t st;
+
+    pmem_stat(&st);
+    strcpy(content, "Node 0, zone   Normal");
+    for(int k = 0; k <= PMEM_MAX_ORDER; k++)
+        append_pad(content, st.nblock[k], 7);
+    strcat(content, "\n");
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
+// 读取/proc/zoneinfo (区域的页数/水位线和hart单页缓存统计)
+static int read_proc_zoneinfo(char* buf, int size, int offset)
+{
+    char content[1024];
+    pmem_stat_t st;
+
+    pmem_stat(&st);
+    strcpy(content, "Node 0, zone   Normal\n");
+    append_num(content, "  pages free     ", st.free);
+    append_num(content, "        min      ", st.wmark_min);
+    append_num(content, "        low      ", st.wmark_low);
+    append_num(content, "        high     ", st.wmark_high);
+    append_num(content, "        managed  ", st.total);
+    append_num(content, "        denied   ", st.nfail);
+    append_num(content, "  pagesets cached ", st.cached);
+    append_num(content, "        alloc    ", st.nalloc);
+    append_num(content, "        hit      ", st.nhit);
+    append_num(content, "        refill   ", st.nrefill);
+    append_num(content, "        drain    ", st.ndrain);
+    append_num(content, "  zeroed pool    ", st.zeroed);
+    append_num(content, "        hit      ", st.zhit);
+    append_num(content, "        miss     ", st.zmiss);
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
+// 读取/proc/unusable_index (各阶的碎片化指数, 0.000 ~ 1.000)
+static int read_proc_unusable_index(char* buf, int size, int offset)
+{
+    char content[512];
+    pmem_stat_t st;
+
+    pmem_stat(&st);
+    strcpy(content, "Node 0, zone   Normal");
+    for(int k = 0; k <= PMEM_MAX_ORDER; k++) {
+        uint32 idx = pmem_frag_index(&st, k);
+        append_pad(content, idx / 1000, 2);
+        strcat(content, ".");
+        append_pad(content, idx / 100 % 10, 1);
+        append_pad(content, idx / 10 % 10, 1);
+        append_pad(content, idx % 10, 1);
+    }
+    strcat(content, "\n");
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
+// 读取/proc/slabinfo (各kmem_cache的对象和slab统计)
+static int read_proc_slabinfo(char* buf, int size, int offset)
+{
+    char content[1024];
+    slab_stat_t st;
+
+    strcpy(content, "# name            <active> <objsize> <objperslab> <pagesperslab> <slabs>    <alloc>      <hit>\n");
+    for(int i = 0; kmem_cache_stat(i, &st) == 0; i++) {
+        if(strlen(content) + 128 > sizeof(content)) break;
+        int n = strlen(st.name);
+        strcat(content, st.name);
+        while(n++ < 16) strcat(content, " ");
+        append_pad(content, st.nactive, 9);
+        append_pad(content, st.size, 10);
+        append_pad(content, st.nper, 13);
+        append_pad(content, 1u << st.order, 15);
+        append_pad(content, st.nslab, 8);
+        append_pad(content, st.nalloc, 11);
+        append_pad(content, st.nhit, 11);
+        strcat(content, "\n");
+    }
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
+// 在content末尾追加一行 "name     value kB\n"
+static void append_kb(char* content, const char* name, uint64 kb)
+{
+    strcat(content, name);
+    append_pad(content, kb, 10);
+    strcat(content, " kB\n");
+}
+
 // 读取/proc/meminfo
 static int read_proc_meminfo(char* buf, int size, int offset)
 {
-    char content[512];
-    
-    // 简化字符串构建，因为没有snprintf
-    strcpy(content, "MemTotal:     131072 kB\n");
-    strcat(content, "MemFree:      65536 kB\n");
-    strcat(content, "MemAvailable: 65536 kB\n");
-    strcat(content, "Buffers:      4 kB\n");
-    strcat(content, "Cached:       8 kB\n");
-    strcat(content, "SwapCached:   0 kB\n");
-    strcat(content, "Active:       65536 kB\n");
-    strcat(content, "Inactive:     8 kB\n");
+    char content[1024];
+    pmem_stat_t st;
+    buf_stat_t bst;
+    uint64 kb = PAGE_SIZE / 1024;
+
+    thp_stat_t thp;
+    pcache_stat_t pst;
+    pmem_stat(&st);
+    buf_stat(&bst);
+    uvm_thp_stat(&thp);
+    ext4_pcache_stat(&pst);
+    uint64 anon = st.nuser > pst.npages ? st.nuser - pst.npages : 0; // 页缓存的页也是按用户页申请的
+    uint64 free = st.free + st.cached + st.zeroed;   // hart缓存和清零池里的页也是空闲的
+    uint64 pipe = ext4_pipe_count() * sizeof(ext4_pipe_t) + fat32_pipe_count() * sizeof(pipe_t);
+
+    content[0] = '\0';
+    append_kb(content, "MemTotal:      ", st.total * kb);
+    append_kb(content, "MemFree:       ", free * kb);
+    append_kb(content, "MemAvailable:  ", (free > st.wmark_min ? free - st.wmark_min : 0) * kb);
+    append_kb(content, "Buffers:       ", bst.nbytes / 1024);
+    append_kb(content, "Cached:        ", (uint64)pst.npages * kb);
+    append_kb(content, "SwapCached:    ", 0);
+    append_kb(content, "Active:        ", st.nuser * kb);
+    append_kb(content, "Inactive:      ", 0);
+    append_kb(content, "AnonPages:     ", anon * kb);
+    append_kb(content, "AnonHugePages: ", thp.nr_huge * VM_MEGA_SIZE / 1024);
+    append_kb(content, "KernelUsed:    ", st.nkernel * kb);
+    append_kb(content, "Slab:          ", kmem_cache_pages() * kb);
+    append_kb(content, "PageTables:    ", vm_pgtbl_pages() * kb);
+    append_kb(content, "PipeBuffers:   ", pipe / 1024);
+    append_kb(content, "BufferTotal:   ", (uint64)bst.nbuf * BLOCK_SIZE / 1024);
+    append_kb(content, "Dirty:         ", (uint64)bst.ndirty * BLOCK_SIZE / 1024 + (uint64)pst.ndirty * kb);
+    append_kb(content, "Writeback:     ", (uint64)bst.nwriteback * BLOCK_SIZE / 1024);
+    append_kb(content, "SwapTotal:     ", 0);
+    append_kb(content, "SwapFree:      ", 0);
     
     int len = strlen(content);
     if (offset >= len) return 0;
@@ -35,6 +220,123 @@ static int read_proc_meminfo(char* buf, int size, int offset)
     return copy_len;
 }
 
+// 读取/proc/vmstat (虚拟内存事件计数)
+static int read_proc_vmstat(char* buf, int size, int offset)
+{
+    char content[1024];
+    thp_stat_t thp;
+    cow_stat_t cow;
+    lazy_stat_t lazy;
+    pcache_stat_t pst;
+    asid_stat_t ast;
+
+    uvm_thp_stat(&thp);
+    uvm_cow_stat(&cow);
+    uvm_lazy_stat(&lazy);
+    ext4_pcache_stat(&pst);
+    vm_asid_stat(&ast);
+    content[0] = '\0';
+    append_num(content, "nr_anon_transparent_hugepages ", thp.nr_huge);
+    append_num(content, "thp_fault_alloc ", thp.nalloc);
+    append_num(content, "thp_fault_fallback ", thp.nfallback);
+    append_num(content, "thp_split_page ", thp.nsplit);
+    append_num(content, "cow_shared_pages ", cow.nshare);
+    append_num(content, "cow_fault_copy ", cow.ncopy);
+    append_num(content, "cow_fault_reuse ", cow.nreuse);
+    append_num(content, "anon_reserved_pages ", lazy.nreserve);
+    append_num(content, "zero_page_fault ", lazy.nzero);
+    append_num(content, "anon_fault_alloc ", lazy.nalloc);
+    append_num(content, "pgfault ", lazy.nminor + lazy.nmajor);
+    append_num(content, "pgmajfault ", lazy.nmajor);
+    append_num(content, "nr_file_pages ", pst.npages);
+    append_num(content, "nr_file_dirty ", pst.ndirty);
+    append_num(content, "pcache_hit ", pst.nhit);
+    append_num(content, "pcache_miss ", pst.nmiss);
+    append_num(content, "pcache_evict ", pst.nevict);
+    append_num(content, "pcache_writeback ", pst.nwriteback);
+    append_num(content, "nr_asids ", ast.nasid);
+    append_num(content, "asid_generation ", ast.generation);
+    append_num(content, "asid_alloc ", ast.nalloc);
+    append_num(content, "asid_rollover ", ast.nrollover);
+    append_num(content, "tlb_flush_asid ", ast.nflush_asid);
+    append_num(content, "tlb_flush_all ", ast.nflush_all);
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
+// 读取/proc/self/faults (当前进程的缺页次数)
+static int read_proc_self_faults(char* buf, int size, int offset)
+{
+    char content[128];
+    proc_t* p = myproc();
+
+    content[0] = '\0';
+    append_num(content, "pid ", p->pid);
+    append_num(content, "minflt ", p->minflt);
+    append_num(content, "majflt ", p->majflt);
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
+// 读取/proc/pagetypeinfo (各阶空闲块数量和已分配页按用途的分布)
+static int read_proc_pagetypeinfo(char* buf, int size, int offset)
+{
+    char content[1024];
+    pmem_stat_t st;
+    buf_stat_t bst;
+
+    pmem_stat(&st);
+    buf_stat(&bst);
+    uint64 slab = kmem_cache_pages();
+    uint64 pgtbl = vm_pgtbl_pages();
+    uint64 other = st.nkernel > slab + pgtbl ? st.nkernel - slab - pgtbl : 0;
+
+    strcpy(content, "Page block order: 0\nPages per block:  1\n\n");
+    strcat(content, "Free pages count per order");
+    for(int k = 0; k <= PMEM_MAX_ORDER; k++)
+        append_pad(content, k, 7);
+    strcat(content, "\nNode 0, zone   Normal     ");
+    for(int k = 0; k <= PMEM_MAX_ORDER; k++)
+        append_pad(content, st.nblock[k], 7);
+    strcat(content, "\n\nNumber of pages by type\n");
+    append_num(content, "  free        ", st.free);
+    append_num(content, "  pcp cached  ", st.cached);
+    append_num(content, "  zeroed      ", st.zeroed);
+    append_num(content, "  user        ", st.nuser);
+    append_num(content, "  kernel      ", st.nkernel);
+    append_num(content, "    slab      ", slab);
+    append_num(content, "    pagetable ", pgtbl);
+    append_num(content, "    other     ", other);
+    strcat(content, "\nBuffer cache (static, not in zone)\n");
+    append_num(content, "  bufs        ", bst.nbuf);
+    append_num(content, "  valid       ", bst.nvalid);
+    append_num(content, "  dirty       ", bst.ndirty);
+    append_num(content, "  writeback   ", bst.nwriteback);
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
 // 读取/proc/mounts
 static int read_proc_mounts(char* buf, int size, int offset)
 {
@@ -53,6 +355,39 @@ static int read_proc_mounts(char* buf, int size, int offset)
     return copy_len;
 }
 
+// 读取/proc/virtio_blk (磁盘请求完成统计)
+static int read_proc_virtio_blk(char* buf, int size, int offset)
+{
+    char content[512];
+    vio_stat_t st;
+    virtio_disk_stat(&st);
+
+    content[0] = '\0';
+    append_num(content, "event_idx:           ", st.event_idx);
+    append_num(content, "poll:                ", st.poll);
+    append_num(content, "queues:              ", st.nqueue);
+    append_num(content, "interrupts:          ", st.nintr);
+    append_num(content, "notifies:            ", st.nnotify);
+    append_num(content, "notifies_suppressed: ", st.nsuppress);
+    append_num(content, "completed_intr:      ", st.nreq_intr);
+    append_num(content, "completed_poll:      ", st.nreq_poll);
+    append_num(content, "poll_miss:           ", st.npoll_miss);
+    append_num(content, "avg_lat_intr_us:     ",
+        st.nreq_intr ? CLOCK_TO_USEC(st.lat_intr / st.nreq_intr) : 0);
+    append_num(content, "avg_lat_poll_us:     ",
+        st.nreq_poll ? CLOCK_TO_USEC(st.lat_poll / st.nreq_poll) : 0);
+    append_num(content, "max_lat_us:          ", CLOCK_TO_USEC(st.lat_max));
+
+    int len = strlen(content);
+    if (offset >= len) return 0;
+
+    int copy_len = len - offset;
+    if (copy_len > size) copy_len = size;
+
+    memcpy(buf, content + offset, copy_len);
+    return copy_len;
+}
+
 // 读取/etc/localtime (简化实现，返回UTC+8)
 static int read_etc_localtime(char* buf, int size, int offset)
 {
@@ -152,6 +487,14 @@ static int write_dev_rtc(const char* buf, int size, int offset)
 static vnode_t vnodes[] = {
     {"/proc/meminfo",   VNODE_PROC_MEMINFO,  0444, read_proc_meminfo, NULL},
     {"/proc/mounts",    VNODE_PROC_MOUNTS,   0444, read_proc_mounts, NULL},
+    {"/proc/virtio_blk", VNODE_PROC_VIRTIO_BLK, 0444, read_proc_virtio_blk, NULL},
+    {"/proc/buddyinfo", VNODE_PROC_BUDDYINFO, 0444, read_proc_buddyinfo, NULL},
+    {"/proc/zoneinfo",  VNODE_PROC_ZONEINFO,  0444, read_proc_zoneinfo, NULL},
+    {"/proc/unusable_index", VNODE_PROC_UNUSABLE_INDEX, 0444, read_proc_unusable_index, NULL},
+    {"/proc/slabinfo", VNODE_PROC_SLABINFO, 0444, read_proc_slabinfo, NULL},
+    {"/proc/pagetypeinfo", VNODE_PROC_PAGETYPEINFO, 0444, read_proc_pagetypeinfo, NULL},
+    {"/proc/vmstat",    VNODE_PROC_VMSTAT,    0444, read_proc_vmstat, NULL},
+    {"/proc/self/faults", VNODE_PROC_SELF_FAULTS, 0444, read_proc_self_faults, NULL},
     {"/etc/localtime",  VNODE_ETC_LOCALTIME, 0644, read_etc_localtime, NULL},
     {"/etc/adjtime",    VNODE_ETC_ADJTIME,   0644, read_etc_adjtime, NULL},
     {"/etc/passwd",     VNODE_ETC_PASSWD,    0644, read_etc_passwd, NULL},
@@ -0,0 +1,145 @@
+/* ASID: 带标签的用户地址空间, 切换页表时不刷新整个TLB */
+
+#include "mem/vmem.h"
+#include "proc/cpu.h"
+#include "lib/print.h"
+#include "riscv.h"
+
+/*
+    ASID 0 留给内核页表, 进程从1开始分配
+    p->asid = 代 << ASID_GEN_SHIFT | ASID, 代和当前代不同(或为0)时重新分配
+    同一代中ASID不会重复分配, 用完之后换代: 每个hart在下一次进入用户态之前刷新整个TLB
+    这样上一代留下的TLB项不会被新的主人看到
+
+    TLB是每个hart私有的, sfence.vma只作用于当前hart
+    进程修改自己的页表时只在当前hart上按ASID刷新
+    进程换到另一个hart上运行时(p->asid_cpu不同), 在那个hart上先按ASID刷新一次
+    所以进程所在的hart上永远没有它的过期TLB项
+
+    硬件不支持ASID(ASID位数为0)时所有页表都使用ASID 0, trampoline在切换页表时刷新整个TLB
+*/
+
+extern pgtbl_t kernel_pagetable;
+
+static struct {
+    spinlock_t lk;
+    uint64 nasid;            // 硬件支持的ASID数, 不超过1表示不支持
+    uint64 generation;       // 当前代
+    uint64 next;             // 当前代中下一个可分配的ASID
+    bool flush[NCPU];        // 换代之后hart还没有刷新整个TLB
+    asid_stat_t st;
+} asids;
+
+static inline bool asid_enabled(void)
+{
+    return asids.nasid > 1;
+}
+
+// 初始化ASID分配器 (kvm_init中调用, 只调用一次)
+void vm_asid_init(void)
+{
+    spinlock_init(&asids.lk, "asid");
+    asids.generation = 1;
+    asids.next = 1;
+}
+
+// 探测这个hart支持的ASID位数 (kvm_inithart中写入内核页表之后调用)
+// 可写的ASID位写入全1后读回仍为1
+void vm_asid_inithart(void)
+{
+    uint64 satp = r_satp();
+    w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+    uint64 n = SATP_ASID(r_satp()) + 1;
+    w_satp(satp);
+    sfence_vma();
+
+    spinlock_acquire(&asids.lk);
+    if(asids.nasid == 0 || n < asids.nasid)
+        asids.nasid = n;
+    asids.st.nasid = asid_enabled() ? asids.nasid : 0;
+    spinlock_release(&asids.lk);
+}
+
+/*
+    进程p回到用户态时使用的satp (trapret_user中调用, 中断关闭)
+    p的ASID不属于当前代时重新分配, 需要时在当前hart上刷新TLB
+*/
+uint64 uvm_satp(proc_t* p)
+{
+    int cpu = mycpuid();
+    bool fresh = false;
+
+    spinlock_acquire(&asids.lk);
+    if(!asid_enabled()) {
+        spinlock_release(&asids.lk);
+        return MAKE_SATP(p->pagetable, 0);
+    }
+    if((p->asid >> ASID_GEN_SHIFT) != asids.generation) {
+        if(asids.next == asids.nasid) {
+            // 用完了: 换代, 所有hart都要丢掉上一代的TLB项
+            asids.generation++;
+            asids.next = 1;
+            for(int i = 0; i < NCPU; i++)
+                asids.flush[i] = true;
+            asids.st.nrollover++;
+        }
+        p->asid = (asids.generation << ASID_GEN_SHIFT) | asids.next++;
+        asids.st.nalloc++;
+        fresh = true;
+    }
+    bool flush_all = asids.flush[cpu];
+    asids.flush[cpu] = false;
+    asids.st.generation = asids.generation;
+    spinlock_release(&asids.lk);
+
+    uint64 asid = p->asid & SATP_ASID_MASK;
+    if(flush_all) {
+        sfence_vma();
+        __sync_fetch_and_add(&asids.st.nflush_all, 1);
+    } else if(!fresh && p->asid_cpu != cpu) {
+        // 上次在别的hart上运行, 这个hart上可能还有更早留下的旧项
+        sfence_vma_asid(asid);
+        __sync_fetch_and_add(&asids.st.nflush_asid, 1);
+    }
+    p->asid_cpu = cpu;
+    return MAKE_SATP(p->pagetable, asid);
+}
+
+/*
+    修改了pagetable之后刷新当前hart的TLB
+    当前进程的页表只刷新它的ASID, 内核页表(或不支持ASID时)刷新整个TLB
+    其他页表(fork中刚建立的/正在销毁的)没有被任何hart使用
+    它们的ASID在这一代中也不会再被用到, 不需要刷新
+*/
+void vm_flush_tlb(pgtbl_t pagetable)
+{
+    proc_t* p = myproc();
+
+    if(pagetable == kernel_pagetable || !asid_enabled()) {
+        sfence_vma();
+        __sync_fetch_and_add(&asids.st.nflush_all, 1);
+    } else if(p != NULL && p->pagetable == pagetable && p->asid != 0) {
+        sfence_vma_asid(p->asid & SATP_ASID_MASK);
+        __sync_fetch_and_add(&asids.st.nflush_asid, 1);
+    }
+}
+
+// 只修改了va所在的一页时使用, 规则同vm_flush_tlb
+void vm_flush_page(pgtbl_t pagetable, uint64 va)
+{
+    proc_t* p = myproc();
+
+    if(pagetable == kernel_pagetable || !asid_enabled()) {
+        sfence_vma();
+        __sync_fetch_and_add(&asids.st.nflush_all, 1);
+    } else if(p != NULL && p->pagetable == pagetable && p->asid != 0) {
+        sfence_vma_page(va, p->asid & SATP_ASID_MASK);
+        __sync_fetch_and_add(&asids.st.nflush_asid, 1);
+    }
+}
+
+// ASID的统计信息
+void vm_asid_stat(asid_stat_t* st)
+{
+    *st = asids.st;
+}
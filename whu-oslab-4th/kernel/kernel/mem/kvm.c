@@ -10,14 +10,36 @@ pgtbl_t kernel_pagetable; // 指向内核页表
 
 extern char trampoline[]; // in trampoline.S 
 
+static uint64 npgtbl = 0; // 页表占用的物理页数 (原子操作)
+
+// 申请一个清零的物理页作为页表
+pgtbl_t vm_pgtbl_alloc(void)
+{
+    pgtbl_t pagetable = (pgtbl_t)pmem_alloc_zeroed(true);
+    if(pagetable) __sync_fetch_and_add(&npgtbl, 1);
+    return pagetable;
+}
+
+// 释放一个页表页
+void vm_pgtbl_free(pgtbl_t pagetable)
+{
+    __sync_fetch_and_sub(&npgtbl, 1);
+    pmem_free_pages((void*)pagetable, 1, true);
+}
+
+// 页表占用的物理页数
+uint64 vm_pgtbl_pages(void)
+{
+    return npgtbl;
+}
+
 // 申请内核页表并完成一些基本映射
 void kvm_init(void)
 {
     // 申请L2内核页表空间
-    kernel_pagetable = (pgtbl_t)pmem_alloc_pages(1, true);
+    kernel_pagetable = vm_pgtbl_alloc();
     // printf("kernel pagetable = %p\n",kernel_pagetable);
     assert(kernel_pagetable != NULL, "kvm.c->kvm_init: 1\n");
-    memset(kernel_pagetable, 0, PAGE_SIZE);
 
     int ret = 0;
     // uart寄存器映射
@@ -30,16 +52,18 @@ void kvm_init(void)
     ret += vm_mappages(kernel_pagetable, RTC_BASE, RTC_BASE, PAGE_SIZE, PTE_R | PTE_W);
     // kernel代码区映射
     ret += vm_mappages(kernel_pagetable, KERNEL_BASE, KERNEL_BASE, KERNEL_TEXT-KERNEL_BASE, PTE_R | PTE_X);
-    // kernel数据区映射
+    // kernel数据区映射 (包括所有可分配的物理页, 2M对齐的部分使用大页)
     ret += vm_mappages(kernel_pagetable, KERNEL_TEXT, KERNEL_TEXT, USER_END-KERNEL_TEXT, PTE_R | PTE_W);
-    // trampoline映射
-    ret += vm_mappages(kernel_pagetable, TRAMPOLINE, (uint64)trampoline, PAGE_SIZE, PTE_R | PTE_X);
+    // trampoline映射 (和所有用户页表中的相同, 全局映射)
+    ret += vm_mappages(kernel_pagetable, TRAMPOLINE, (uint64)trampoline, PAGE_SIZE, PTE_R | PTE_X | PTE_G);
     
     // 验证映射是否成功
     assert(ret == 0,"vmem.c->kvm_init 2\n");
     
     // 进程列表的内核栈映射
     proc_mapstacks(kernel_pagetable);
+    // ASID分配器
+    vm_asid_init();
 }
 
 // 开启分页模式
@@ -47,36 +71,41 @@ void kvm_inithart(void)
 {
     // flush the TLB
     sfence_vma();
-    // 写入内核页表,开启sv39模式的分页
-    w_satp(MAKE_SATP(kernel_pagetable));
+    // 写入内核页表(ASID 0),开启sv39模式的分页
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
     // flush the TLB
     sfence_vma();
+    // 探测硬件支持的ASID数
+    vm_asid_inithart();
 }
 
 
-// 根据pagetable,找到va对应的pte
-// 若设置alloc=true 则在PTE无效时尝试申请一个物理页
+// 找到va在第level级的PTE (0: 4K页, 1: 2M大页, 2: 1G大页)
+// 若设置alloc=true 则在中间PTE无效时尝试申请一个物理页作为页表
+// 途中遇到更高一级的大页叶子PTE时: 查找直接返回它, 申请(alloc)则失败
 // 成功返回PTE, 失败返回NULL
-pte_t* vm_getpte(pgtbl_t pagetable, uint64 va, bool alloc)
+static pte_t* vm_walk(pgtbl_t pagetable, uint64 va, bool alloc, int level)
 {
     assert(va < VA_MAX, "kvm.c->vm_getpte\n");
     
-    for(int level = 2; level > 0; level--) {
+    for(int cur = 2; cur > level; cur--) {
 
         // 在当前页表下,找到va对应的pte
-        pte_t* pte = &pagetable[VA_TO_VPN(va, level)]; 
+        pte_t* pte = &pagetable[VA_TO_VPN(va, cur)]; 
         
         if(*pte & PTE_V) {   // 有效PTE
 
+            // 大页的叶子PTE
+            if(PTE_IS_LEAF(*pte)) return alloc ? NULL : pte;
+
             // 更新pagetable指向下一级页表
             pagetable = (pgtbl_t)PTE_TO_PA(*pte);
         
         } else if(alloc) {  // 无效PTE但是尝试申请
         
             // 申请一个物理页作为页表并清空
-            pagetable = (pgtbl_t)pmem_alloc_pages(1, true);
+            pagetable = vm_pgtbl_alloc();
             if(pagetable == NULL) return NULL;
-            memset(pagetable, 0, PAGE_SIZE);
 
             // 修改PTE中的物理地址并设为有效
             *pte = PA_TO_PTE(pagetable) | PTE_V;
@@ -88,12 +117,152 @@ pte_t* vm_getpte(pgtbl_t pagetable, uint64 va, bool alloc)
         }
     }
 
-    return &pagetable[VA_TO_VPN(va, 0)];
+    return &pagetable[VA_TO_VPN(va, level)];
+}
+
+// 根据pagetable,找到va对应的pte
+// 若设置alloc=true 则在PTE无效时尝试申请一个物理页
+// va落在大页里时: 查找返回大页的叶子PTE, 申请返回NULL
+// 成功返回PTE, 失败返回NULL
+pte_t* vm_getpte(pgtbl_t pagetable, uint64 va, bool alloc)
+{
+    return vm_walk(pagetable, va, alloc, 0);
+}
+
+// 找到va所在的叶子PTE, 它所在的级别放在level中
+// 没有有效映射时返回NULL
+pte_t* vm_getleaf(pgtbl_t pagetable, uint64 va, int* level)
+{
+    assert(va < VA_MAX, "kvm.c->vm_getleaf\n");
+
+    for(int cur = 2; cur >= 0; cur--) {
+        pte_t* pte = &pagetable[VA_TO_VPN(va, cur)];
+        if((*pte & PTE_V) == 0) return NULL;
+        if(PTE_IS_LEAF(*pte) || cur == 0) {
+            *level = cur;
+            return pte;
+        }
+        pagetable = (pgtbl_t)PTE_TO_PA(*pte);
+    }
+    return NULL;
+}
+
+// va所在的0级页表, 用于顺序处理同一张页表中连续的PTE (只需要从根下降一次)
+// 若设置alloc=true 则在没有页表时申请
+// va所在的2M已经是大页映射, 或者没有页表且不申请(或申请失败)时返回NULL
+pgtbl_t vm_leaf_table(pgtbl_t pagetable, uint64 va, bool alloc)
+{
+    pte_t* pte = vm_walk(pagetable, va, alloc, 1);
+    if(pte == NULL) return NULL;
+    if(*pte & PTE_V)
+        return PTE_IS_LEAF(*pte) ? NULL : (pgtbl_t)PTE_TO_PA(*pte);
+    if(!alloc) return NULL;
+
+    pgtbl_t table = vm_pgtbl_alloc();
+    if(table == NULL) return NULL;
+    *pte = PA_TO_PTE(table) | PTE_V;
+    return table;
 }
 
+// 页表中是否已经没有有效PTE
+static bool vm_pgtbl_empty(pgtbl_t table)
+{
+    for(int i = 0; i < PAGE_SIZE / sizeof(pte_t); i++)
+        if(table[i] & PTE_V) return false;
+    return true;
+}
+
+/*
+    遍历第level级页表table中[va, end)范围内的PTE
+    无效的中间PTE代表的整个子树(2M/1G)直接跳过, 有效的中间PTE下降一次处理连续的一段
+    叶子PTE交给fn, fn把大页拆成页表后接着进入拆出的页表
+    prune: 下一级页表处理完之后变空就释放它
+*/
+static int vm_walk_level(pgtbl_t table, int level, uint64 va, uint64 end,
+                         bool prune, vm_leaf_fn_t fn, void* arg, bool* freed)
+{
+    uint64 size = VM_LEVEL_SIZE(level);
+    int ret;
+
+    for(int i = VA_TO_VPN(va, level); i < 512 && va < end; i++, va = ALIGN_DOWN(va, size) + size) {
+        pte_t* pte = &table[i];
+        if((*pte & PTE_V) == 0) continue;
+        if(PTE_IS_LEAF(*pte)) {
+            if((ret = fn(pte, va, level, arg)) < 0) return ret;
+            if((*pte & PTE_V) == 0 || PTE_IS_LEAF(*pte)) continue;
+        }
+        assert(level > 0, "kvm.c->vm_walk_level\n");
+        pgtbl_t child = (pgtbl_t)PTE_TO_PA(*pte);
+        ret = vm_walk_level(child, level - 1, va, min(end, ALIGN_DOWN(va, size) + size), prune, fn, arg, freed);
+        if(ret < 0) return ret;
+        if(prune && vm_pgtbl_empty(child)) {
+            *pte = 0;
+            vm_pgtbl_free(child);
+            *freed = true;
+        }
+    }
+    return 0;
+}
+
+// 对[va, end)中的每个有效叶子PTE调用fn(pte, va, level, arg)
+// va是叶子中第一个落在范围内的地址 (大页可能只有一部分在范围内)
+// prune=true时释放变空的中间页表
+// 成功返回0, fn返回负数时停止遍历并返回它
+int vm_walk_range(pgtbl_t pagetable, uint64 va, uint64 end, bool prune, vm_leaf_fn_t fn, void* arg)
+{
+    bool freed = false;
+
+    assert(va % PAGE_SIZE == 0 && end <= VA_MAX, "kvm.c->vm_walk_range\n");
+    if(va >= end) return 0;
+    int ret = vm_walk_level(pagetable, 2, va, end, prune, fn, arg, &freed);
+    // 被释放的页表页可能还在页表缓存中
+    if(freed) vm_flush_tlb(pagetable);
+    return ret;
+}
+
+// 在va处建立一个2M大页映射 (va和pa按2M对齐), 用于用户的透明大页
+// va所在的1级PTE已经被页表或映射占用时失败
+// 成功返回0, 失败返回-1
+int vm_map_mega(pgtbl_t pagetable, uint64 va, uint64 pa, int perm)
+{
+    assert(va % VM_MEGA_SIZE == 0 && pa % VM_MEGA_SIZE == 0, "kvm.c->vm_map_mega\n");
+    pte_t* pte = vm_walk(pagetable, va, true, 1);
+    if(pte == NULL || (*pte & PTE_V)) return -1;
+    *pte = PA_TO_PTE(pa) | perm | PTE_V;
+    return 0;
+}
+
+// 清空[va, end)中由vm_mappages建立的叶子PTE, 不释放物理页 (vm_mappages失败时回滚)
+static void vm_unmap_leaves(pgtbl_t pagetable, uint64 va, uint64 end)
+{
+    int level;
+    while(va < end) {
+        pte_t* pte = vm_getleaf(pagetable, va, &level);
+        assert(pte != NULL, "kvm.c->vm_unmap_leaves\n");
+        *pte = 0;
+        va += VM_LEVEL_SIZE(level);
+    }
+}
+
+// [va, va+left)映射到pa时, 从va开始能使用的最大页的级别
+static int vm_map_level(pgtbl_t pagetable, uint64 va, uint64 pa, uint64 left)
+{
+    for(int level = 2; level > 0; level--) {
+        uint64 size = VM_LEVEL_SIZE(level);
+        if(va % size != 0 || pa % size != 0 || left < size)
+            continue;
+        // 这个位置已经有页表(或映射)了, 不能覆盖
+        pte_t* pte = vm_walk(pagetable, va, false, level);
+        if(pte != NULL && (*pte & PTE_V))
+            continue;
+        return level;
+    }
+    return 0;
+}
  
 // 在pagetable中建立映射 [va, va+len)->[pa, pa+len) 
-// 映射是页面级的, 页面权限为perm
+// 页面权限为perm, 内核映射(perm不含PTE_U)在va和pa对齐时使用2M/1G大页
+// 用户映射总是4K页 (uvm按页管理它们)
 // pa 应当保证page-aligned, va 和 len 不需要保证
 // 成功返回0, 失败返回-1
 int vm_mappages(pgtbl_t pagetable, uint64 va, uint64 pa, uint64 len, int perm)
@@ -102,30 +271,40 @@ int vm_mappages(pgtbl_t pagetable, uint64 va, uint64 pa, uint64 len, int perm)
 
     // 确定映射范围
     uint64 first_page = ALIGN_DOWN(va, PAGE_SIZE);
-    uint64 last_page  = ALIGN_DOWN(va+len-1, PAGE_SIZE);
+    uint64 end        = ALIGN_DOWN(va+len-1, PAGE_SIZE) + PAGE_SIZE;
     uint64 cur_page   = first_page;
     
+    pgtbl_t table = NULL; // 当前所在的0级页表, 同一张页表内的4K页不再从根查找
     pte_t* pte;
-    int count = 0;
+    int level;
     // 开始逐页映射
     
-    while(cur_page <= last_page) {
+    while(cur_page < end) {
         
+        level = (perm & PTE_U) ? 0 : vm_map_level(pagetable, cur_page, pa, end - cur_page);
+
         // 拿到pte并修改它
-        pte = vm_getpte(pagetable, cur_page, true);
-        if(pte == NULL) goto fail;
+        if(level == 0) {
+            if(table == NULL || cur_page % VM_MEGA_SIZE == 0)
+                table = vm_leaf_table(pagetable, cur_page, true);
+            if(table == NULL) goto fail;
+            pte = &table[VA_TO_VPN(cur_page, 0)];
+        } else {
+            table = NULL;
+            pte = vm_walk(pagetable, cur_page, true, level);
+            if(pte == NULL) goto fail;
+        }
         *pte = PA_TO_PTE(pa) | perm | PTE_V;
 
         // 迭代
-        cur_page += PAGE_SIZE;
-        pa       += PAGE_SIZE;
-        count++; 
+        cur_page += VM_LEVEL_SIZE(level);
+        pa       += VM_LEVEL_SIZE(level);
     }
 
     return 0;
 
 fail:
-    uvm_unmappages(pagetable, first_page, count, false);
+    vm_unmap_leaves(pagetable, first_page, cur_page);
     return -1;
 }
 
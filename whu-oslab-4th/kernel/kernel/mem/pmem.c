@@ -5,16 +5,14 @@
 #include "mem/pmem.h"
 #include "lock/lock.h"
 #include "memlayout.h"
+#include "proc/cpu.h"
+#include "proc/proc.h"
+#include "dev/timer.h"
 
 /*
 --------------------------------- USER_END    (0x8800-0000)
 
-// 可分配的用户数据区
-
---------------------------------- USER_BASE   (4KB对齐)
-
-// 可分配的内核数据区 
-(size = KERNEL_PAGE_NUM * 4KB)
+// 可分配的物理页 (内核和用户共用)
 
 --------------------------------- KERNEL_DATA (4KB对齐)
 
@@ -35,128 +33,569 @@
 ---------------------------------
 */
 
-uint64 USER_BASE;
+/*
+    伙伴系统:
+    [KERNEL_DATA, USER_END) 是一个区域(zone), 内核和用户按需从中申请
+    2^k个页组成一个k阶块, base按最大块对齐, 所以块的物理地址也按自身大小对齐
+    (大页映射要求9阶块2MB对齐), [base, KERNEL_DATA)中的页永远不是空闲的
+    k阶块i的伙伴是 i ^ (1<<k), 释放时和空闲的伙伴逐级合并
+    空闲块用块内第一个页里的双向链表节点串起来, 每阶一条链表
+    pg_flag记录每个物理页是否是空闲块的第一个页以及块的阶
+    非2的幂的npages向上取整到2的幂, 释放时要传入相同的npages
+
+    水位线 (空闲页数):
+    min:  内核保留, 用户申请不能让空闲页低于它, 内核申请可以用光
+    low:  低于它时释放的单页不再留在hart缓存里, 直接还给伙伴系统
+    high: 低于它时后台线程不再补充清零池
+
+    每个hart的单页缓存 (pcp):
+    单页的申请和释放先在当前hart的缓存里进行, 只有缓存空了或满了
+    才以PCP_BATCH个页为一批持有伙伴系统的锁一次性补充或归还
+    缓存的锁只有所属的hart使用 (伙伴系统耗尽时其他hart会来清空它)
+
+    写时复制的引用计数:
+    pg_ref记录用户页除了申请者之外还被多少个页表共享 (fork时增加)
+    释放时先消耗引用计数, 计数为0的页才真正还给伙伴系统
+
+    延迟清零:
+    释放时不再清零, 伙伴系统和hart缓存里的页都视为脏页
+    后台线程pmem_zeroer在空闲时从伙伴系统取页清零, 放入清零池
+    pmem_alloc_zeroed优先从清零池取页, 池空时申请后当场清零
+    普通申请在伙伴系统耗尽时也可以使用清零池里的页
+*/
 
-#define KERNEL_PAGE_NUM 1024 // 4MB 内核空间
+#define PHYS_BASE 0x80000000ul        // 物理内存起点
+#define PHYS_SIZE (128ul * 1024 * 1024) // 物理内存大小 (和_USER_END一致)
+
+#define PG_FREE       0x80 // 空闲块的第一个页
+#define PG_ORDER_MASK 0x0F // 空闲块的阶
+
+typedef struct freenode {
+    struct freenode* next;
+    struct freenode* prev;
+} freenode_t;
+
+typedef struct buddy {
+    uint64 base;                           // 第一个页的物理地址 (按最大块对齐)
+    uint64 npages;                         // [base, end)的页数
+    uint64 nskip;                          // [base, start)中不归伙伴系统管理的页数
+    uint64 nfree;                          // 空闲页数
+    freenode_t head[PMEM_MAX_ORDER + 1];   // 各阶空闲块链表 (双向循环, head是哨兵)
+    uint32 nblock[PMEM_MAX_ORDER + 1];     // 各阶空闲块数量
+    uint64 wmark_min;                      // 水位线
+    uint64 wmark_low;
+    uint64 wmark_high;
+    uint64 nfail;                          // 因水位线被拒绝的用户申请次数
+    uint64 nused[2];                       // 已分配出去的页数 [in_kernel] (原子操作, 不受lk保护)
+    spinlock_t lk;
+} buddy_t;
 
-void* vio_mem; // 两个连续物理页，在virtio中使用
+static buddy_t zone; // 唯一的区域
 
-typedef struct listnode {
-    struct listnode* next;
-} listnode_t;
+#define PCP_HIGH  64 // 每个hart每个区域最多缓存的页数
+#define PCP_BATCH 16 // 一次和伙伴系统交换的页数
 
-// 内核空闲页链表
-struct {
-    listnode_t freelist;
+// 每个hart的单页缓存
+typedef struct pcp {
+    uint64 page[PCP_HIGH];  // 缓存的页(栈)
+    int count;              // 缓存的页数
+    uint64 nalloc;          // 单页申请次数
+    uint64 nhit;            // 直接从缓存拿到页的次数
+    uint64 nrefill;         // 批量补充次数
+    uint64 ndrain;          // 批量归还次数
     spinlock_t lk;
-} kmem;
+} pcp_t;
+
+static pcp_t pcps[NCPU];
 
-// 用户空闲页链表
-struct {
-    listnode_t freelist;
+#define ZERO_POOL  256 // 清零池的容量
+#define ZERO_BATCH 8   // 后台线程每清零这么多页让出一次CPU
+
+// 已经清零的空闲页
+typedef struct zpool {
+    uint64 page[ZERO_POOL]; // 清零过的页(栈)
+    int count;              // 池中的页数
+    uint64 nhit;            // pmem_alloc_zeroed直接拿到清零页的次数
+    uint64 nmiss;           // 池空, 申请后当场清零的次数
     spinlock_t lk;
-} umem;
+} zpool_t;
 
+static zpool_t zpool;
 
-// 物理内存初始化
-void pmem_init(bool output)
+static uint8 pg_flag[PHYS_SIZE / PAGE_SIZE]; // 每个物理页的状态
+static uint32 pg_ref[PHYS_SIZE / PAGE_SIZE]; // 每个物理页额外的共享者数量 (原子操作)
+
+static inline uint8* page_flag(uint64 pa)
 {
-    uint64 pa;
-    listnode_t* node;
+    return &pg_flag[(pa - PHYS_BASE) / PAGE_SIZE];
+}
 
-    spinlock_init(&kmem.lk, "kern mem");
-    spinlock_init(&umem.lk, "user mem");
-    kmem.freelist.next = NULL;
-    umem.freelist.next = NULL;
+static inline uint32* page_ref(uint64 pa)
+{
+    return &pg_ref[(pa - PHYS_BASE) / PAGE_SIZE];
+}
 
-    USER_BASE = KERNEL_TEXT + KERNEL_PAGE_NUM * PAGE_SIZE;
-    
-    // 内核空间 页链表的建立    
-    spinlock_acquire(&kmem.lk);
-    for(pa = KERNEL_DATA; pa < USER_BASE; pa += PAGE_SIZE) {
-        node = (listnode_t*)pa;
-        node->next = kmem.freelist.next;
-        kmem.freelist.next = node;
+static inline void list_push(freenode_t* head, freenode_t* node)
+{
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+}
+
+static inline void list_del(freenode_t* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+}
+
+// 把pa开始的order阶块挂到空闲链表上, 调用者持有b->lk
+static inline void block_add(buddy_t* b, uint64 pa, int order)
+{
+    list_push(&b->head[order], (freenode_t*)pa);
+    *page_flag(pa) = PG_FREE | order;
+    b->nblock[order]++;
+}
+
+// 把pa开始的order阶块从空闲链表上摘下, 调用者持有b->lk
+static inline void block_del(buddy_t* b, uint64 pa, int order)
+{
+    list_del((freenode_t*)pa);
+    *page_flag(pa) = 0;
+    b->nblock[order]--;
+}
+
+// 把 [start, end) 交给伙伴系统b管理
+static void buddy_init(buddy_t* b, uint64 start, uint64 end, char* name)
+{
+    spinlock_init(&b->lk, name);
+    b->base = ALIGN_DOWN(start, PAGE_SIZE << PMEM_MAX_ORDER);
+    b->npages = (end - b->base) / PAGE_SIZE;
+    b->nskip = (start - b->base) / PAGE_SIZE;
+    b->nfree = b->npages - b->nskip;
+    for(int k = 0; k <= PMEM_MAX_ORDER; k++) {
+        b->head[k].next = b->head[k].prev = &b->head[k];
+        b->nblock[k] = 0;
+    }
+
+    // 从start开始, 每次放入对齐且不越界的最大块
+    uint64 i = b->nskip;
+    while(i < b->npages) {
+        int k = PMEM_MAX_ORDER;
+        while(k > 0 && ((i & ((1ul << k) - 1)) != 0 || i + (1ul << k) > b->npages))
+            k--;
+        block_add(b, b->base + i * PAGE_SIZE, k);
+        i += 1ul << k;
+    }
+
+    // 内核保留约1/64的内存, 限制在 [64, 1024] 页
+    b->wmark_min = min(max((b->npages - b->nskip) / 64, 64), 1024);
+    b->wmark_low = b->wmark_min + b->wmark_min / 4;
+    b->wmark_high = b->wmark_min + b->wmark_min / 2;
+    b->nfail = 0;
+    b->nused[0] = b->nused[1] = 0;
+}
+
+// 申请一个order阶块, 申请后空闲页不能少于reserve
+// 失败返回0, 调用者持有b->lk
+static uint64 __buddy_alloc(buddy_t* b, int order, uint64 reserve)
+{
+    uint64 pa = 0;
+
+    if(b->nfree < (1ul << order) + reserve)
+        return 0;
+
+    // 0阶链表非空时直接取
+    int k = order;
+    while(k <= PMEM_MAX_ORDER && b->head[k].next == &b->head[k])
+        k++;
+    if(k <= PMEM_MAX_ORDER) {
+        pa = (uint64)b->head[k].next;
+        block_del(b, pa, k);
+        // 拆分: 把多出来的后一半逐级放回
+        while(k > order) {
+            k--;
+            block_add(b, pa + (PAGE_SIZE << k), k);
+        }
+        b->nfree -= 1ul << order;
+    }
+
+    return pa;
+}
+
+// 释放pa开始的order阶块, 和空闲的伙伴合并, 调用者持有b->lk
+static void __buddy_free(buddy_t* b, uint64 pa, int order)
+{
+    uint64 i = (pa - b->base) / PAGE_SIZE;
+    assert((i & ((1ul << order) - 1)) == 0, "buddy_free: 1\n");
+
+    assert((*page_flag(pa) & PG_FREE) == 0, "buddy_free: 2\n"); // 重复释放
+    b->nfree += 1ul << order;
+    while(order < PMEM_MAX_ORDER) {
+        uint64 bi = i ^ (1ul << order);
+        if(bi + (1ul << order) > b->npages) break;
+        uint64 bpa = b->base + bi * PAGE_SIZE;
+        if(*page_flag(bpa) != (PG_FREE | order)) break;
+        block_del(b, bpa, order);
+        i &= ~(1ul << order);
+        order++;
+    }
+    block_add(b, b->base + i * PAGE_SIZE, order);
+}
+
+static uint64 buddy_alloc(buddy_t* b, int order, uint64 reserve)
+{
+    spinlock_acquire(&b->lk);
+    uint64 pa = __buddy_alloc(b, order, reserve);
+    spinlock_release(&b->lk);
+    return pa;
+}
+
+static void buddy_free(buddy_t* b, uint64 pa, int order)
+{
+    spinlock_acquire(&b->lk);
+    __buddy_free(b, pa, order);
+    spinlock_release(&b->lk);
+}
+
+// 把c中最上面的n个页归还给b, 调用者持有c->lk
+static void pcp_drain(pcp_t* c, buddy_t* b, int n)
+{
+    n = min(n, c->count);
+    if(n == 0) return;
+    spinlock_acquire(&b->lk);
+    for(int i = 0; i < n; i++)
+        __buddy_free(b, c->page[--c->count], 0);
+    spinlock_release(&b->lk);
+    c->ndrain++;
+}
+
+// 从b批量补充c, 调用者持有c->lk
+static void pcp_refill(pcp_t* c, buddy_t* b, uint64 reserve)
+{
+    spinlock_acquire(&b->lk);
+    while(c->count < PCP_BATCH) {
+        uint64 pa = __buddy_alloc(b, 0, reserve);
+        if(pa == 0) break;
+        c->page[c->count++] = pa;
+    }
+    spinlock_release(&b->lk);
+    c->nrefill++;
+}
+
+// 锁住当前hart的缓存
+static pcp_t* pcp_lock(void)
+{
+    push_off();
+    pcp_t* c = &pcps[mycpuid()];
+    spinlock_acquire(&c->lk);
+    pop_off();
+    return c;
+}
+
+// 伙伴系统耗尽时清空所有hart的缓存
+static void pcp_drain_all(buddy_t* b)
+{
+    for(int i = 0; i < NCPU; i++) {
+        pcp_t* c = &pcps[i];
+        spinlock_acquire(&c->lk);
+        pcp_drain(c, b, c->count);
+        spinlock_release(&c->lk);
+    }
+}
+
+// 单页申请: 先查当前hart的缓存
+// hart缓存里的页已经离开了伙伴系统, 用户也可以直接使用
+static uint64 pcp_alloc(buddy_t* b, uint64 reserve)
+{
+    uint64 pa = 0;
+    pcp_t* c = pcp_lock();
+    c->nalloc++;
+    if(c->count > 0) {
+        c->nhit++;
+    } else {
+        pcp_refill(c, b, reserve);
+    }
+    if(c->count > 0)
+        pa = c->page[--c->count];
+    spinlock_release(&c->lk);
+
+    if(pa == 0) { // 别的hart可能还缓存着空闲页
+        pcp_drain_all(b);
+        pa = buddy_alloc(b, 0, reserve);
     }
-    spinlock_release(&kmem.lk);
-
-    // 用户空间 页链表的建立
-    spinlock_acquire(&umem.lk);
-    for(pa = USER_BASE; pa < USER_END; pa += PAGE_SIZE) {
-        node = (listnode_t*)pa;
-        node->next = umem.freelist.next;
-        umem.freelist.next = node;        
+    return pa;
+}
+
+// 单页释放: 放回当前hart的缓存, 满了先归还一批
+// 空闲页低于low水位线时全部还给伙伴系统, 让其他hart和大块申请可以使用
+static void pcp_free(buddy_t* b, uint64 pa)
+{
+    pcp_t* c = pcp_lock();
+    if(c->count == PCP_HIGH)
+        pcp_drain(c, b, PCP_BATCH);
+    c->page[c->count++] = pa;
+    if(b->nfree < b->wmark_low)
+        pcp_drain(c, b, c->count);
+    spinlock_release(&c->lk);
+}
+
+static bool page_unref(uint64 pa, int npages);
+
+// npages个页需要的阶
+static int pages_to_order(int npages)
+{
+    int order = 0;
+    while((1 << order) < npages)
+        order++;
+    return order;
+}
+
+// 按8字节清零一个页 (比逐字节的memset快)
+static void zero_page(uint64 pa)
+{
+    uint64* p = (uint64*)pa;
+    for(int i = 0; i < PAGE_SIZE / sizeof(uint64); i++)
+        p[i] = 0;
+}
+
+// 从清零池取一个页, 池空时返回0
+static uint64 zpool_get(zpool_t* z)
+{
+    uint64 pa = 0;
+    spinlock_acquire(&z->lk);
+    if(z->count > 0)
+        pa = z->page[--z->count];
+    spinlock_release(&z->lk);
+    return pa;
+}
+
+/*
+    后台清零线程: 把清零池补满后睡到下一个tick
+    每清零ZERO_BATCH个页让出一次CPU, 只占用其他进程不用的时间
+*/
+static void pmem_zeroer(void)
+{
+    uint64 last;
+
+    while(1) {
+        int n = 0;
+        while(zpool.count < ZERO_POOL) {
+            // 空闲页低于high水位线时不再往池里放
+            uint64 pa = buddy_alloc(&zone, 0, zone.wmark_high);
+            if(pa == 0) break;
+            zero_page(pa);
+            spinlock_acquire(&zpool.lk);
+            if(zpool.count < ZERO_POOL) {
+                zpool.page[zpool.count++] = pa;
+                pa = 0;
+            }
+            spinlock_release(&zpool.lk);
+            if(pa) buddy_free(&zone, pa, 0); // 别人已经补满了
+            if(++n % ZERO_BATCH == 0)
+                proc_yield();
+        }
+
+        spinlock_acquire(&ticks_lk);
+        last = ticks;
+        while(ticks == last)
+            proc_sleep(&ticks, &ticks_lk);
+        spinlock_release(&ticks_lk);
     }
-    spinlock_release(&umem.lk);
+}
+
+// 启动后台清零线程 (首进程创建之后调用)
+void pmem_zeroer_init(void)
+{
+    proc_kthread(pmem_zeroer);
+}
+
+// 物理内存初始化
+void pmem_init(bool output)
+{
+    assert(USER_END <= PHYS_BASE + PHYS_SIZE, "pmem_init: 1\n");
 
-    vio_mem = pmem_alloc_pages(1, true);
-    pmem_alloc_pages(1, true);
+    buddy_init(&zone, KERNEL_DATA, USER_END, "zone");
+    for(int i = 0; i < NCPU; i++)
+        spinlock_init(&pcps[i].lk, "pcp");
+    spinlock_init(&zpool.lk, "zero pool");
 
     if(output) {
         printf("here is memlayout:\n");
         printf("kern_base = 0x0000-0000-8020-0000\n");
         printf("kern_text = %p\n",KERNEL_TEXT);
         printf("kern_data = %p\n",KERNEL_DATA);
-        printf("user_base = %p\n",USER_BASE);
         printf("user_end  = 0x0000-0000-8800-0000\n");
         printf("pmem_init success!\n");
     }
 }
 
 /*
-    申请npage个4K物理页
+    申请npage个物理地址连续的4K物理页 (向上取整到2的幂)
+    用户申请不能动用min水位线以下的内核保留页
+    页的内容是任意的, 需要全0的页请用pmem_alloc_zeroed
     成功返回物理页地址 失败返回NULL
 */
 void* pmem_alloc_pages(int npages, bool in_kernel)
 {
-    assert(npages == 1, "pmem_alloc_pages\n");
+    assert(npages >= 1 && npages <= (1 << PMEM_MAX_ORDER), "pmem_alloc_pages\n");
     
-    listnode_t* node;
-
-    if(in_kernel) {
-        spinlock_acquire(&kmem.lk);
-        node = kmem.freelist.next;
-        if(node) kmem.freelist.next = node->next;
-        else kmem.freelist.next = NULL;
-        spinlock_release(&kmem.lk);
+    uint64 reserve = in_kernel ? 0 : zone.wmark_min;
+    uint64 pa;
+    if(npages == 1) {
+        pa = pcp_alloc(&zone, reserve);
+        if(pa == 0) // 最后的后备: 清零池
+            pa = zpool_get(&zpool);
     } else {
-        spinlock_acquire(&umem.lk);
-        node = umem.freelist.next;
-        if(node) umem.freelist.next = node->next;
-        else umem.freelist.next = NULL;
-        spinlock_release(&umem.lk);
+        pa = buddy_alloc(&zone, pages_to_order(npages), reserve);
+        if(pa == 0) { // hart缓存里的单页还回去后可能合并出足够大的块
+            pcp_drain_all(&zone);
+            pa = buddy_alloc(&zone, pages_to_order(npages), reserve);
+        }
     }
+    if(pa)
+        __sync_fetch_and_add(&zone.nused[in_kernel ? 1 : 0], 1ul << pages_to_order(npages));
+    else if(!in_kernel)
+        __sync_fetch_and_add(&zone.nfail, 1);
+    return (void*)pa;
+}
 
-    return (void*)node;
+/*
+    申请一个内容全为0的4K物理页
+    优先使用后台线程清零过的页
+*/
+void* pmem_alloc_zeroed(bool in_kernel)
+{
+    uint64 pa = zpool_get(&zpool);
+    if(pa) {
+        __sync_fetch_and_add(&zpool.nhit, 1);
+        __sync_fetch_and_add(&zone.nused[in_kernel ? 1 : 0], 1);
+        return (void*)pa;
+    }
+
+    __sync_fetch_and_add(&zpool.nmiss, 1);
+    pa = (uint64)pmem_alloc_pages(1, in_kernel);
+    if(pa) zero_page(pa);
+    return (void*)pa;
 }
 /*
     释放npages个物理页,从ptr指向的地址开始
+    npages和in_kernel必须和申请时相同
+    被写时复制共享的用户页只减少引用计数
 */
 void pmem_free_pages(void* ptr, int npages, bool in_kernel)
 {     
-    assert(npages == 1, "pmem_free_pages: 1\n");
+    assert(npages >= 1 && npages <= (1 << PMEM_MAX_ORDER), "pmem_free_pages: 1\n");
     assert((uint64)ptr % PAGE_SIZE == 0, "pmem_free_pages: 2\n");
+    assert((uint64)ptr >= KERNEL_DATA && (uint64)ptr < USER_END, "pmem_free_pages: 3\n");
+
+    int order = pages_to_order(npages);
+    if(!in_kernel && page_unref((uint64)ptr, 1 << order))
+        return;
+    __sync_fetch_and_sub(&zone.nused[in_kernel ? 1 : 0], 1ul << order);
+    if(order == 0)
+        pcp_free(&zone, (uint64)ptr);
+    else
+        buddy_free(&zone, (uint64)ptr, order);
+}
 
-    memset(ptr, 0, PAGE_SIZE);
-    listnode_t* node = (listnode_t*)ptr;
+/*
+    释放被共享的用户页: 有共享者的页只减少引用计数, 其余的页逐个释放
+    没有任何页被共享时返回false, 由调用者整块释放
+*/
+static bool page_unref(uint64 pa, int npages)
+{
+    int i;
+    for(i = 0; i < npages; i++)
+        if(*page_ref(pa + i * PAGE_SIZE) != 0) break;
+    if(i == npages) return false;
+
+    for(i = 0; i < npages; i++, pa += PAGE_SIZE) {
+        uint32* ref = page_ref(pa);
+        uint32 old;
+        do {
+            old = *ref;
+        } while(old != 0 && !__sync_bool_compare_and_swap(ref, old, old - 1));
+        if(old == 0) { // 最后一个使用者
+            __sync_fetch_and_sub(&zone.nused[0], 1);
+            pcp_free(&zone, pa);
+        }
+    }
+    return true;
+}
 
-    if(in_kernel) {
-        
-        assert((uint64)ptr >= KERNEL_DATA && (uint64)ptr < USER_BASE, "pmem_free_pages: 3\n");
-        
-        spinlock_acquire(&kmem.lk);
-        node->next = kmem.freelist.next;
-        kmem.freelist.next = node;
-        spinlock_release(&kmem.lk);
+// 用户页[pa, pa+npages*4K)多了一个共享者 (fork时共享页)
+void pmem_dup_pages(void* ptr, int npages)
+{
+    for(int i = 0; i < npages; i++)
+        __sync_fetch_and_add(page_ref((uint64)ptr + i * PAGE_SIZE), 1);
+}
 
-    } else {
-        
-        assert((uint64)ptr >= USER_BASE && (uint64)ptr < USER_END, "pmem_free_pages: 4\n");
-        
-        spinlock_acquire(&umem.lk);
-        node->next = umem.freelist.next;
-        umem.freelist.next = node;
-        spinlock_release(&umem.lk);
-    
+// 用户页[pa, pa+npages*4K)中是否有页被共享
+bool pmem_shared(void* ptr, int npages)
+{
+    for(int i = 0; i < npages; i++)
+        if(*page_ref((uint64)ptr + i * PAGE_SIZE) != 0)
+            return true;
+    return false;
+}
+
+/*
+    ptr所在的npages个页的块的起始地址
+    伙伴系统的块相对base按自身大小对齐, 所以可以由块内任意地址算出
+    (slab用它由对象地址找到所在的slab)
+*/
+void* pmem_block_head(void* ptr, int npages)
+{
+    uint64 size = (uint64)PAGE_SIZE << pages_to_order(npages);
+    return (void*)(zone.base + (((uint64)ptr - zone.base) & ~(size - 1)));
+}
+
+// 读取伙伴系统的统计信息
+void pmem_stat(pmem_stat_t* st)
+{
+    spinlock_acquire(&zone.lk);
+    st->total = zone.npages - zone.nskip;
+    st->free = zone.nfree;
+    for(int k = 0; k <= PMEM_MAX_ORDER; k++)
+        st->nblock[k] = zone.nblock[k];
+    st->wmark_min = zone.wmark_min;
+    st->wmark_low = zone.wmark_low;
+    st->wmark_high = zone.wmark_high;
+    st->nfail = zone.nfail;
+    spinlock_release(&zone.lk);
+    st->nkernel = zone.nused[1];
+    st->nuser = zone.nused[0];
+
+    st->cached = st->nalloc = st->nhit = st->nrefill = st->ndrain = 0;
+    for(int i = 0; i < NCPU; i++) {
+        pcp_t* c = &pcps[i];
+        spinlock_acquire(&c->lk);
+        st->cached  += c->count;
+        st->nalloc  += c->nalloc;
+        st->nhit    += c->nhit;
+        st->nrefill += c->nrefill;
+        st->ndrain  += c->ndrain;
+        spinlock_release(&c->lk);
     }
-}
\ No newline at end of file
+
+    spinlock_acquire(&zpool.lk);
+    st->zeroed = zpool.count;
+    st->zhit = zpool.nhit;
+    st->zmiss = zpool.nmiss;
+    spinlock_release(&zpool.lk);
+}
+
+/*
+    order阶的碎片化指数 (千分比)
+    空闲页中无法用来满足order阶申请的比例: 0表示没有碎片, 1000表示全部是碎片
+*/
+uint32 pmem_frag_index(pmem_stat_t* st, int order)
+{
+    if(st->free == 0) return 0;
+    uint64 usable = 0;
+    for(int k = order; k <= PMEM_MAX_ORDER; k++)
+        usable += (uint64)st->nblock[k] << k;
+    return (uint32)((st->free - usable) * 1000 / st->free);
+}
@@ -0,0 +1,320 @@
+/* 进程mmap区域的索引: 按起始地址排序的AVL树 */
+
+#include "mem/vmem.h"
+#include "mem/slab.h"
+#include "fs/ext4_inode.h"
+#include "lib/print.h"
+#include "memlayout.h"
+#include "common.h"
+
+/*
+    每个进程的mmap区域组成一棵AVL树(p->vm_root), 以start为键, 区域之间互不重叠
+    每个结点额外记录子树的信息, 在旋转和插入删除的回溯路径上重新计算:
+    lo/hi    子树中最低的start和最高的end
+    maxgap   子树内相邻区域之间最大的空洞
+    于是查找区域/查找空洞/插入/删除/拆分/合并都是O(log n)
+
+    区域树只有所属进程自己访问(fork时父进程在自己的上下文中复制), 不需要加锁
+*/
+
+// vm_region 的slab cache
+static kmem_cache_t* vm_region_cache;
+
+void uvm_region_init(void)
+{
+    vm_region_cache = kmem_cache_create("vm_region", sizeof(vm_region_t));
+}
+
+// 返回一个可以用的vm_region (内容清零), 内存不足时返回NULL
+vm_region_t* uvm_region_alloc()
+{
+    return kmem_cache_zalloc(vm_region_cache);
+}
+
+// 释放region结构体和它持有的inode引用 (不碰页表), 可能睡眠
+void uvm_region_put(vm_region_t* region)
+{
+    if(region->ip != NULL)
+        ext4_inode_put(region->ip);
+    kmem_cache_free(vm_region_cache, region);
+}
+
+static inline int region_height(vm_region_t* n)
+{
+    return n ? n->height : 0;
+}
+
+// 由左右子树重新计算n的高度和空洞信息
+static void region_update(vm_region_t* n)
+{
+    uint64 end = VM_REGION_END(n);
+
+    n->height = 1 + max(region_height(n->left), region_height(n->right));
+    n->lo = n->left ? n->left->lo : n->start;
+    n->hi = n->right ? n->right->hi : end;
+    n->maxgap = 0;
+    if(n->left)
+        n->maxgap = max(n->left->maxgap, n->start - n->left->hi);
+    if(n->right)
+        n->maxgap = max(n->maxgap, max(n->right->maxgap, n->right->lo - end));
+}
+
+static vm_region_t* rotate_right(vm_region_t* n)
+{
+    vm_region_t* l = n->left;
+    n->left = l->right;
+    l->right = n;
+    region_update(n);
+    region_update(l);
+    return l;
+}
+
+static vm_region_t* rotate_left(vm_region_t* n)
+{
+    vm_region_t* r = n->right;
+    n->right = r->left;
+    r->left = n;
+    region_update(n);
+    region_update(r);
+    return r;
+}
+
+// 更新n并在左右高度差超过1时旋转, 返回子树新的根
+static vm_region_t* region_balance(vm_region_t* n)
+{
+    region_update(n);
+    int bf = region_height(n->left) - region_height(n->right);
+    if(bf > 1) {
+        if(region_height(n->left->left) < region_height(n->left->right))
+            n->left = rotate_left(n->left);
+        return rotate_right(n);
+    }
+    if(bf < -1) {
+        if(region_height(n->right->right) < region_height(n->right->left))
+            n->right = rotate_right(n->right);
+        return rotate_left(n);
+    }
+    return n;
+}
+
+static vm_region_t* region_insert(vm_region_t* n, vm_region_t* region)
+{
+    if(n == NULL) {
+        region->left = region->right = NULL;
+        region_update(region);
+        return region;
+    }
+    if(region->start < n->start)
+        n->left = region_insert(n->left, region);
+    else
+        n->right = region_insert(n->right, region);
+    return region_balance(n);
+}
+
+// 摘下子树中start最小的结点, 放在*min中
+static vm_region_t* region_remove_min(vm_region_t* n, vm_region_t** min)
+{
+    if(n->left == NULL) {
+        *min = n;
+        return n->right;
+    }
+    n->left = region_remove_min(n->left, min);
+    return region_balance(n);
+}
+
+static vm_region_t* region_remove(vm_region_t* n, uint64 start)
+{
+    vm_region_t* min;
+
+    assert(n != NULL, "uvm_region_remove: 0");
+    if(start < n->start) {
+        n->left = region_remove(n->left, start);
+    } else if(start > n->start) {
+        n->right = region_remove(n->right, start);
+    } else {
+        if(n->left == NULL) return n->right;
+        if(n->right == NULL) return n->left;
+        // 用后继结点代替n
+        min = NULL;
+        vm_region_t* right = region_remove_min(n->right, &min);
+        min->left = n->left;
+        min->right = right;
+        n = min;
+    }
+    return region_balance(n);
+}
+
+// 把region插入树中 (不能和已有区域重叠)
+void uvm_region_insert(vm_region_t** root, vm_region_t* region)
+{
+    *root = region_insert(*root, region);
+}
+
+// 把region从树中摘下 (region本身不释放)
+void uvm_region_remove(vm_region_t** root, vm_region_t* region)
+{
+    *root = region_remove(*root, region->start);
+    region->left = region->right = NULL;
+}
+
+// 包含va的区域, 没有返回NULL
+vm_region_t* uvm_region_find(vm_region_t* root, uint64 va)
+{
+    vm_region_t* n = root;
+    while(n != NULL) {
+        if(va < n->start) n = n->left;
+        else if(va >= VM_REGION_END(n)) n = n->right;
+        else return n;
+    }
+    return NULL;
+}
+
+// 地址最低的满足end > va的区域 (包含va或在va之后的第一个), 没有返回NULL
+vm_region_t* uvm_region_first(vm_region_t* root, uint64 va)
+{
+    vm_region_t *n = root, *ret = NULL;
+    while(n != NULL) {
+        if(VM_REGION_END(n) > va) {
+            ret = n;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return ret;
+}
+
+/*
+    在addr处把region拆成[start, addr)和[addr, end)两个区域
+    文件映射的后一半调整文件偏移并增加inode的引用
+    返回后一半, 内存不足时返回NULL (region不变)
+*/
+vm_region_t* uvm_region_split(vm_region_t** root, vm_region_t* region, uint64 addr)
+{
+    assert(addr > region->start && addr < VM_REGION_END(region) && addr % PAGE_SIZE == 0,
+           "uvm_region_split: 0");
+    vm_region_t* upper = uvm_region_alloc();
+    if(upper == NULL) return NULL;
+    uint64 npages = (addr - region->start) / PAGE_SIZE;
+
+    upper->start = addr;
+    upper->npages = region->npages - npages;
+    upper->flags = region->flags;
+    upper->perm = region->perm;
+    upper->ip = region->ip ? ext4_inode_dup(region->ip) : NULL;
+    upper->off = region->off + (addr - region->start);
+
+    // region的键不变, 但end变了, 重新插入以更新路径上的空洞信息
+    uvm_region_remove(root, region);
+    region->npages = npages;
+    uvm_region_insert(root, region);
+    uvm_region_insert(root, upper);
+    return upper;
+}
+
+// 相邻的两个区域(a在b前面)能否合并成一个
+static bool region_mergeable(vm_region_t* a, vm_region_t* b)
+{
+    if(a == NULL || b == NULL || VM_REGION_END(a) != b->start) return false;
+    if(a->flags != b->flags || a->perm != b->perm || a->ip != b->ip) return false;
+    return a->ip == NULL || a->off + (uint64)a->npages * PAGE_SIZE == b->off;
+}
+
+// 把b并入a并释放b, 两者都在树中
+static void region_absorb(vm_region_t** root, vm_region_t* a, vm_region_t* b)
+{
+    uvm_region_remove(root, b);
+    uvm_region_remove(root, a);
+    a->npages += b->npages;
+    uvm_region_insert(root, a);
+    uvm_region_put(b); // a持有同一个inode的引用, 这里不会真正释放inode
+}
+
+// 把region和前后属性相同且紧挨着的区域合并, 返回合并后的区域
+vm_region_t* uvm_region_merge(vm_region_t** root, vm_region_t* region)
+{
+    vm_region_t* next = uvm_region_find(*root, VM_REGION_END(region));
+    if(region_mergeable(region, next))
+        region_absorb(root, region, next);
+
+    vm_region_t* prev = region->start > 0 ? uvm_region_find(*root, region->start - 1) : NULL;
+    if(region_mergeable(prev, region)) {
+        region_absorb(root, prev, region);
+        region = prev;
+    }
+    return region;
+}
+
+// 子树内部第一个(地址最低的)不小于size的空洞的起点, 没有返回0
+static uint64 region_gap_find(vm_region_t* n, uint64 size)
+{
+    while(n != NULL && n->maxgap >= size) {
+        if(n->left && n->left->maxgap >= size) {
+            n = n->left;
+            continue;
+        }
+        if(n->left && n->start - n->left->hi >= size)
+            return n->left->hi;
+        if(n->right && n->right->lo - VM_REGION_END(n) >= size)
+            return VM_REGION_END(n);
+        n = n->right;
+    }
+    return 0;
+}
+
+/*
+    在[VM_MMAP_START, VM_MMAP_END)中找一段size字节的空闲地址(first-fit), 起点按align对齐
+    被munmap释放的地址可以再次使用
+    成功返回起点, 没有足够大的空洞返回0
+*/
+uint64 uvm_region_hole(vm_region_t* root, uint64 size, uint64 align)
+{
+    uint64 need = size + align - PAGE_SIZE; // 对齐最多浪费align-PAGE_SIZE
+    uint64 addr;
+
+    if(root == NULL)
+        addr = (VM_MMAP_END - VM_MMAP_START >= need) ? VM_MMAP_START : 0;
+    else if(root->lo - VM_MMAP_START >= need)
+        addr = VM_MMAP_START;
+    else if((addr = region_gap_find(root, need)) == 0 && VM_MMAP_END - root->hi >= need)
+        addr = root->hi;
+    return addr ? ALIGN_UP(addr, align) : 0;
+}
+
+// 释放整棵树的region结构体 (不碰页表)
+static void region_put_tree(vm_region_t* root)
+{
+    if(root == NULL) return;
+    region_put_tree(root->left);
+    region_put_tree(root->right);
+    uvm_region_put(root);
+}
+
+/*
+    复制整棵树 (fork时使用, 父子进程各自持有一份, 形状不变)
+    内存不足时释放已经复制的部分并返回NULL (root非空时NULL表示失败)
+*/
+vm_region_t* uvm_region_copy(vm_region_t* root)
+{
+    if(root == NULL) return NULL;
+
+    vm_region_t* region = uvm_region_alloc();
+    if(region == NULL) return NULL;
+    region->start = root->start;
+    region->npages = root->npages;
+    region->flags = root->flags;
+    region->perm = root->perm;
+    region->ip = root->ip ? ext4_inode_dup(root->ip) : NULL;
+    region->off = root->off;
+    region->height = root->height;
+    region->lo = root->lo;
+    region->hi = root->hi;
+    region->maxgap = root->maxgap;
+    region->left = uvm_region_copy(root->left);
+    region->right = uvm_region_copy(root->right);
+    if((root->left && region->left == NULL) || (root->right && region->right == NULL)) {
+        region_put_tree(region);
+        return NULL;
+    }
+    return region;
+}
@@ -0,0 +1,271 @@
+/* slab分配器: 固定大小的内核对象 */
+
+#include "mem/slab.h"
+#include "mem/pmem.h"
+#include "proc/cpu.h"
+#include "lib/print.h"
+#include "lib/str.h"
+#include "memlayout.h"
+
+/*
+    每种对象一个kmem_cache, 对象放在slab里
+    slab是从伙伴系统申请的2^order个连续内核页, 开头是slab_t, 后面紧跟对象
+    伙伴系统的块按自身大小对齐, 由对象地址可以直接算出所在slab (pmem_block_head)
+    slab按使用情况挂在partial/full/free三条链表上, 全空的slab最多保留一个
+
+    每个hart有一个对象缓存:
+    申请和释放先在当前hart的缓存里进行, 空了或满了才以SLAB_BATCH个对象为一批
+    持有cache->lk和slab交换, 所以大部分操作不碰共享的锁
+*/
+
+static kmem_cache_t caches[SLAB_NCACHE];
+static int ncache = 0;
+static spinlock_t caches_lk = {0, "kmem_caches", -1};
+
+static inline void slab_list_init(slab_t* head)
+{
+    head->next = head->prev = head;
+}
+
+static inline bool slab_list_empty(slab_t* head)
+{
+    return head->next == head;
+}
+
+static inline void slab_list_push(slab_t* head, slab_t* s)
+{
+    s->next = head->next;
+    s->prev = head;
+    head->next->prev = s;
+    head->next = s;
+}
+
+static inline void slab_list_del(slab_t* s)
+{
+    s->prev->next = s->next;
+    s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+// 第一个对象相对slab开头的偏移
+static inline uint32 slab_hdr(void)
+{
+    return ALIGN_UP(sizeof(slab_t), 8);
+}
+
+/*
+    创建一个对象大小为size的cache
+    选择能容纳SLAB_MIN_OBJS个对象的最小order
+*/
+kmem_cache_t* kmem_cache_create(char* name, uint32 size)
+{
+    size = ALIGN_UP(max(size, sizeof(void*)), 8);
+
+    uint32 order = 0;
+    while(order < SLAB_MAX_ORDER && ((PAGE_SIZE << order) - slab_hdr()) / size < SLAB_MIN_OBJS)
+        order++;
+    uint32 nper = ((PAGE_SIZE << order) - slab_hdr()) / size;
+    assert(nper >= 1, "kmem_cache_create: 1\n");
+
+    spinlock_acquire(&caches_lk);
+    assert(ncache < SLAB_NCACHE, "kmem_cache_create: 2\n");
+    kmem_cache_t* c = &caches[ncache++];
+    spinlock_release(&caches_lk);
+
+    strncpy(c->name, name, sizeof(c->name) - 1);
+    c->size = size;
+    c->order = order;
+    c->nper = nper;
+    slab_list_init(&c->partial);
+    slab_list_init(&c->full);
+    slab_list_init(&c->free);
+    c->nslab = 0;
+    c->nactive = 0;
+    c->nalloc = 0;
+    c->nhit = 0;
+    for(int i = 0; i < NCPU; i++) {
+        c->cpu[i].count = 0;
+        spinlock_init(&c->cpu[i].lk, "slab cpu");
+    }
+    spinlock_init(&c->lk, "kmem_cache");
+    return c;
+}
+
+// 申请一个新的slab并切分成对象, 失败返回NULL, 调用者持有c->lk
+static slab_t* slab_grow(kmem_cache_t* c)
+{
+    slab_t* s = (slab_t*)pmem_alloc_pages(1 << c->order, true);
+    if(s == NULL) return NULL;
+
+    s->cache = c;
+    s->inuse = 0;
+    s->freelist = NULL;
+    uint64 obj = (uint64)s + slab_hdr();
+    for(uint32 i = 0; i < c->nper; i++, obj += c->size) {
+        *(void**)obj = s->freelist;
+        s->freelist = (void*)obj;
+    }
+    c->nslab++;
+    return s;
+}
+
+// 从slab中取出最多n个对象放入cpu缓存, 返回取出的数量, 调用者持有cpu->lk
+static int slab_refill(kmem_cache_t* c, slab_cpu_t* cpu, int n)
+{
+    int got = 0;
+
+    spinlock_acquire(&c->lk);
+    while(got < n) {
+        slab_t* s;
+        if(!slab_list_empty(&c->partial)) {
+            s = c->partial.next;
+            slab_list_del(s);
+        } else if(!slab_list_empty(&c->free)) {
+            s = c->free.next;
+            slab_list_del(s);
+        } else {
+            s = slab_grow(c);
+            if(s == NULL) break;
+        }
+
+        while(got < n && s->freelist) {
+            void* obj = s->freelist;
+            s->freelist = *(void**)obj;
+            s->inuse++;
+            cpu->obj[cpu->count++] = obj;
+            got++;
+        }
+
+        if(s->freelist) slab_list_push(&c->partial, s);
+        else slab_list_push(&c->full, s);
+    }
+    spinlock_release(&c->lk);
+
+    return got;
+}
+
+// 把cpu缓存最上面的n个对象还给所在的slab, 调用者持有cpu->lk
+static void slab_drain(kmem_cache_t* c, slab_cpu_t* cpu, int n)
+{
+    slab_t* release = NULL; // 多余的空slab, 放锁后还给伙伴系统
+
+    spinlock_acquire(&c->lk);
+    for(int i = 0; i < n && cpu->count > 0; i++) {
+        void* obj = cpu->obj[--cpu->count];
+        slab_t* s = (slab_t*)pmem_block_head(obj, 1 << c->order);
+        assert(s->cache == c, "slab_drain: 1\n");
+
+        bool was_full = (s->freelist == NULL);
+        *(void**)obj = s->freelist;
+        s->freelist = obj;
+        s->inuse--;
+
+        if(s->inuse == 0) {
+            slab_list_del(s);
+            if(slab_list_empty(&c->free)) {
+                slab_list_push(&c->free, s);
+            } else {
+                c->nslab--;
+                s->next = release;
+                release = s;
+            }
+        } else if(was_full) {
+            slab_list_del(s);
+            slab_list_push(&c->partial, s);
+        }
+    }
+    spinlock_release(&c->lk);
+
+    while(release) {
+        slab_t* next = release->next;
+        pmem_free_pages(release, 1 << c->order, true);
+        release = next;
+    }
+}
+
+// 锁住当前hart的对象缓存
+static slab_cpu_t* cpu_lock(kmem_cache_t* c)
+{
+    push_off();
+    slab_cpu_t* cpu = &c->cpu[mycpuid()];
+    spinlock_acquire(&cpu->lk);
+    pop_off();
+    return cpu;
+}
+
+// 申请一个对象, 内容是任意的
+// 失败返回NULL
+void* kmem_cache_alloc(kmem_cache_t* c)
+{
+    void* obj = NULL;
+
+    slab_cpu_t* cpu = cpu_lock(c);
+    __sync_fetch_and_add(&c->nalloc, 1);
+    if(cpu->count > 0)
+        __sync_fetch_and_add(&c->nhit, 1);
+    else
+        slab_refill(c, cpu, SLAB_BATCH);
+    if(cpu->count > 0)
+        obj = cpu->obj[--cpu->count];
+    spinlock_release(&cpu->lk);
+
+    if(obj) __sync_fetch_and_add(&c->nactive, 1);
+    return obj;
+}
+
+// 申请一个对象并清零
+void* kmem_cache_zalloc(kmem_cache_t* c)
+{
+    void* obj = kmem_cache_alloc(c);
+    if(obj) memset(obj, 0, c->size);
+    return obj;
+}
+
+// 释放对象
+void kmem_cache_free(kmem_cache_t* c, void* obj)
+{
+    assert(obj != NULL, "kmem_cache_free: 1\n");
+
+    slab_cpu_t* cpu = cpu_lock(c);
+    if(cpu->count == SLAB_CPU_MAX)
+        slab_drain(c, cpu, SLAB_BATCH);
+    cpu->obj[cpu->count++] = obj;
+    spinlock_release(&cpu->lk);
+
+    __sync_fetch_and_sub(&c->nactive, 1);
+}
+
+// 已分配给调用者的对象数
+uint32 kmem_cache_inuse(kmem_cache_t* c)
+{
+    return c->nactive;
+}
+
+// 第i个cache的统计信息
+// 成功返回0, 不存在返回-1
+int kmem_cache_stat(int i, slab_stat_t* st)
+{
+    if(i < 0 || i >= ncache) return -1;
+
+    kmem_cache_t* c = &caches[i];
+    spinlock_acquire(&c->lk);
+    memmove(st->name, c->name, sizeof(st->name));
+    st->size = c->size;
+    st->order = c->order;
+    st->nper = c->nper;
+    st->nslab = c->nslab;
+    st->nactive = c->nactive;
+    st->nalloc = c->nalloc;
+    st->nhit = c->nhit;
+    spinlock_release(&c->lk);
+    return 0;
+}
+
+// 所有slab占用的物理页数
+uint64 kmem_cache_pages(void)
+{
+    uint64 n = 0;
+    for(int i = 0; i < ncache; i++)
+        n += (uint64)caches[i].nslab << caches[i].order;
+    return n;
+}
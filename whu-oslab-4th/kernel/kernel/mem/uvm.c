@@ -1,52 +1,160 @@
 #include "mem/vmem.h"
 #include "mem/pmem.h"
+#include "mem/slab.h"
 #include "proc/cpu.h"
 #include "lib/print.h"
 #include "lib/str.h"
 #include "memlayout.h"
 #include "fs/ext4_file.h"
 #include "fs/ext4_inode.h"
+#include "fs/ext4_pcache.h"
 #include "proc/proc.h"
 #include "common.h"
+#include "riscv.h"
 
-#define N_VM_REGION 128
+/*
+    按需分配 (demand-zero):
+    brk和匿名mmap只保留虚拟地址范围, 不申请物理页
+    第一次读(或执行)时映射全局共享的零页, 可写区域的零页带PTE_COW
+    第一次写时申请清零的物理页 (按2M对齐的空白区间尝试透明大页)
+    零页由内核持有, 每个映射增加一次引用计数, 所以永远不会被释放
+*/
+static uint64 zero_pa;
+static lazy_stat_t lazy; // 原子操作
 
-// vm_region 数组
-static vm_region_t vm_region_list[N_VM_REGION];
-
-// vm_region_list init
+// vm_region cache + 零页 init
 void uvm_init()
 {
-    for(int i = 0; i < N_VM_REGION; i++) {
-        vm_region_list[i].start = 0;
-        vm_region_list[i].npages = 0;
-        vm_region_list[i].flags = 0;
-        vm_region_list[i].next = NULL;
-    }
+    uvm_region_init();
+    zero_pa = (uint64)pmem_alloc_zeroed(true);
+    assert(zero_pa != 0, "uvm_init: zero page\n");
 }
 
-// 返回一个可以用的vm_region
-vm_region_t* uvm_region_alloc()
+/*
+    文件映射region中[start, end)的共享页: 被写过(PTE_D)的标记为脏页并清除PTE_D
+    然后把这段文件的脏页写回
+    可能睡眠, 调用者不能持有自旋锁
+*/
+static int sync_leaf(pte_t* pte, uint64 va, int level, void* arg)
 {
-    vm_region_t* region = NULL;
-    for(int i = 0; i < N_VM_REGION; i++) {
-        if(vm_region_list[i].start == 0) {
-            region = &vm_region_list[i];
-            break;
-        }
+    vm_region_t* region = arg;
+    if((*pte & PTE_SHA) && (*pte & PTE_D)) {
+        ext4_pcache_dirty(region->ip, (region->off + (va - region->start)) / PAGE_SIZE);
+        *pte &= ~PTE_D;
     }
-    assert(region != NULL, "vm_region_alloc");
-    return region;
+    return 0;
+}
+
+static void uvm_region_sync(pgtbl_t pagetable, vm_region_t* region, uint64 start, uint64 end)
+{
+    uint64 first = (region->off + (start - region->start)) / PAGE_SIZE;
+    uint64 last = (region->off + (end - region->start)) / PAGE_SIZE - 1;
+
+    if(region->ip == NULL || (region->flags & MAP_SHARED) == 0) return;
+    vm_walk_range(pagetable, start, end, false, sync_leaf, region);
+    vm_flush_tlb(pagetable); // 之后的写入要重新设置PTE_D
+
+    ext4_inode_lock(region->ip);
+    ext4_pcache_writeback(region->ip, first, last);
+    ext4_inode_unlock(region->ip);
 }
 
-// 释放region资源, 同时释放占用的物理页
+// 释放region资源, 同时释放占用的物理页 (region已经不在树中)
+// 文件映射先写回脏页并放弃inode的引用, 可能睡眠
 void uvm_region_free(pgtbl_t pagetable, vm_region_t* region)
 {
+    uvm_region_sync(pagetable, region, region->start, VM_REGION_END(region));
     uvm_unmappages(pagetable, region->start, region->npages, true);
-    region->start = 0;
-    region->npages = 0;
-    region->next = NULL;
-    region->flags = 0;
+    uvm_region_put(region);
+}
+
+// 释放整棵树的region (进程退出时在睡眠安全的上下文中调用)
+void uvm_free_regions(pgtbl_t pagetable, vm_region_t* root)
+{
+    if(root == NULL) return;
+    uvm_free_regions(pagetable, root->left);
+    uvm_free_regions(pagetable, root->right);
+    uvm_region_free(pagetable, root);
+}
+
+/*
+    透明大页 (THP):
+    匿名mmap和brk覆盖了按2M对齐的完整2M区间时, 尝试申请2^9个连续物理页
+    用一个1级叶子PTE映射, 没有连续物理内存时退回4K页
+    部分解除映射/修改权限时先把大页拆成512个4K页 (物理页不动)
+*/
+static thp_stat_t thp; // 原子操作
+static cow_stat_t cow; // 原子操作
+
+// 申请一个清零的2M物理块 (物理地址2M对齐), 失败返回0
+static uint64 thp_alloc(void)
+{
+    uint64 pa = (uint64)pmem_alloc_pages(VM_MEGA_NPAGES, false);
+    if(pa != 0 && pa % VM_MEGA_SIZE != 0) { // 伙伴系统的块应当按自身大小对齐, 防御性检查
+        pmem_free_pages((void*)pa, VM_MEGA_NPAGES, false);
+        pa = 0;
+    }
+    if(pa == 0) {
+        __sync_fetch_and_add(&thp.nfallback, 1);
+        return 0;
+    }
+    uint64* p = (uint64*)pa;
+    for(uint64 i = 0; i < VM_MEGA_SIZE / sizeof(uint64); i++)
+        p[i] = 0;
+    return pa;
+}
+
+// 在va处映射一个清零的2M大页, 成功返回true
+static bool thp_map(pgtbl_t pagetable, uint64 va, int perm)
+{
+    uint64 pa = thp_alloc();
+    if(pa == 0) return false;
+    if(vm_map_mega(pagetable, va, pa, perm) < 0) {
+        pmem_free_pages((void*)pa, VM_MEGA_NPAGES, false);
+        __sync_fetch_and_add(&thp.nfallback, 1);
+        return false;
+    }
+    __sync_fetch_and_add(&thp.nalloc, 1);
+    __sync_fetch_and_add(&thp.nr_huge, 1);
+    return true;
+}
+
+// 把1级大页叶子PTE换成一张映射同样512个4K页的页表 (物理页不动)
+// 调用者负责刷新TLB
+// 成功返回0, 申请页表失败返回-1
+static int thp_split(pte_t* pte)
+{
+    pgtbl_t table = vm_pgtbl_alloc();
+    if(table == NULL) return -1;
+    uint64 pa = PTE_TO_PA(*pte);
+    int flags = PTE_FLAGS(*pte);
+    for(int i = 0; i < VM_MEGA_NPAGES; i++)
+        table[i] = PA_TO_PTE(pa + i * PAGE_SIZE) | flags;
+    *pte = PA_TO_PTE(table) | PTE_V;
+
+    __sync_fetch_and_sub(&thp.nr_huge, 1);
+    __sync_fetch_and_add(&thp.nsplit, 1);
+    return 0;
+}
+
+// 把va所在的2M大页拆成512个4K页, va不在大页中时什么都不做
+// 成功返回0, 申请页表失败返回-1
+int uvm_split_mega(pgtbl_t pagetable, uint64 va)
+{
+    int level;
+    pte_t* pte = vm_getleaf(pagetable, va, &level);
+    if(pte == NULL || level == 0) return 0;
+    assert(level == 1, "uvm_split_mega: 1\n");
+
+    if(thp_split(pte) < 0) return -1;
+    vm_flush_tlb(pagetable);
+    return 0;
+}
+
+// 透明大页的统计信息
+void uvm_thp_stat(thp_stat_t* st)
+{
+    *st = thp;
 }
 
 //  逐级查询pagetable找到va对应的pa
@@ -54,49 +162,67 @@ void uvm_region_free(pgtbl_t pagetable, vm_region_t* region)
 uint64 uvm_getpa(pgtbl_t pagetable, uint64 va)
 {
     assert(va < VA_MAX, "uvm_getpa");
-    pte_t* pte = vm_getpte(pagetable, va, false);
+    int level;
+    pte_t* pte = vm_getleaf(pagetable, va, &level);
     // 确认拿到的PTE是有效的用户态的PTE
     if(pte == NULL) return 0;
     if((*pte & PTE_V) == 0) return 0;
     if((*pte & PTE_U) == 0) return 0;
-    uint64 pa = PTE_TO_PA(*pte);
+    // 大页: 加上va所在4K页在大页内的偏移
+    uint64 pa = PTE_TO_PA(*pte) + ALIGN_DOWN(va % VM_LEVEL_SIZE(level), PAGE_SIZE);
     return pa;
 }
 
+// uvm_unmappages的遍历参数
+typedef struct unmap_arg {
+    uint64 end;
+    bool freeit;
+} unmap_arg_t;
+
+static int unmap_leaf(pte_t* pte, uint64 va, int level, void* arg)
+{
+    unmap_arg_t* a = arg;
+
+    assert(level <= 1, "uvm_unmappages 4\n");
+    if(level > 0) {
+        // 整个大页都在范围内: 一次释放
+        if(va % VM_MEGA_SIZE == 0 && va + VM_MEGA_SIZE <= a->end) {
+            if(a->freeit) pmem_free_pages((void*)PTE_TO_PA(*pte), VM_MEGA_NPAGES, false);
+            *pte = 0;
+            __sync_fetch_and_sub(&thp.nr_huge, 1);
+            return 0;
+        }
+        // 只解除一部分: 先拆成4K页, 遍历接着进入拆出的页表
+        assert(thp_split(pte) == 0, "uvm_unmappages 5\n");
+        return 0;
+    }
+
+    // 释放占用的物理页
+    if(a->freeit) pmem_free_pages((void*)PTE_TO_PA(*pte), 1, false);
+
+    // 清空pte
+    *pte = 0;
+    return 0;
+}
+
 //  对从va开始的npages个页面解除映射
 //  va需保证page-aligned
 //  如果freeit置为true,同时释放被映射的物理页
+//  按需分配的区域中可能有还没映射的页: 空的子树整片跳过, 变空的中间页表随之释放
 void uvm_unmappages(pgtbl_t pagetable, uint64 va, uint64 npages, bool freeit)
 {
     assert(va % PAGE_SIZE == 0, "uvm_unmappages 1\n");
-    pte_t* pte;
+    unmap_arg_t arg = { va + PAGE_SIZE * npages, freeit };
 
-    // printf("va = %p npages = %d\n", va, npages);
-    for(uint64 cur_va = va; cur_va < va + PAGE_SIZE * npages; cur_va += PAGE_SIZE) {
-        
-        // 获取 pte 并验证 非空 + 有效 + 指向data page
-        pte = vm_getpte(pagetable, cur_va, false);
-        // printf("va = %p, pte = %p\n", cur_va, *pte);
-        assert(pte != NULL, "uvm_unmappages 2\n");
-        assert((*pte) & PTE_V, "uvm_unmappages 3\n");
-        assert((*pte) & (PTE_R | PTE_W | PTE_X) , "uvm_unmappages 4\n");
-        
-        // 释放占用的物理页
-        if(freeit) pmem_free_pages((void*)PTE_TO_PA(*pte), 1, false);
-        
-        // 清空pte
-        *pte = 0;
-    }
+    vm_walk_range(pagetable, va, arg.end, true, unmap_leaf, &arg);
+    vm_flush_tlb(pagetable);
 }
 
 //  申请一个L2用户态页表并清空
 //  成功返回pagetable, 失败返回NULL
 pgtbl_t uvm_alloc_pagetable() 
 {
-    pgtbl_t pagetable = (pgtbl_t)pmem_alloc_pages(1, true);
-    if(pagetable != NULL) 
-        memset(pagetable, 0, PAGE_SIZE);
-    return pagetable;
+    return vm_pgtbl_alloc();
 }
 
 //  解除L2->L1,L1->L0这两级pagetable的映射关系
@@ -123,86 +249,421 @@ void uvm_free_pagetable(pgtbl_t pagetable)
         }
     }
     // 回收页表占用的物理页
-    pmem_free_pages((void*)pagetable, 1, true);
+    vm_pgtbl_free(pagetable);
+}
+
+// uvm_copy_range的遍历参数
+typedef struct copy_arg {
+    pgtbl_t new;
+    uint64 end;
+    pgtbl_t table;   // new中当前的0级页表, 同一个2M区间内的4K页直接填写
+    uint64 base;     // table覆盖的2M区间
+    uint64 done;     // 已经复制到的位置
+} copy_arg_t;
+
+static int copy_leaf(pte_t* pte, uint64 va, int level, void* arg)
+{
+    copy_arg_t* a = arg;
+    uint64 size = VM_LEVEL_SIZE(level);
+
+    a->done = va;
+    assert((*pte) & (PTE_R | PTE_W | PTE_X), "uvm_copy_range: 3\n");
+    assert(va % size == 0 && va + size <= a->end, "uvm_copy_range: 4\n");
+
+    // 父进程的可写页变成写时复制页 (MAP_SHARED的页两边都直接可写)
+    if((*pte & PTE_W) && (*pte & PTE_SHA) == 0)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+
+    // pte -> pa + flags
+    uint64 pa = PTE_TO_PA(*pte);
+    int flags = PTE_FLAGS(*pte);
+
+    if(level > 0) {
+        if(vm_map_mega(a->new, va, pa, flags & ~PTE_V) == 0)
+            __sync_fetch_and_add(&thp.nr_huge, 1);
+        else if(vm_mappages(a->new, va, pa, size, flags & ~PTE_V) < 0)
+            return -1;
+    } else {
+        if(a->table == NULL || ALIGN_DOWN(va, VM_MEGA_SIZE) != a->base) {
+            a->table = vm_leaf_table(a->new, va, true);
+            a->base = ALIGN_DOWN(va, VM_MEGA_SIZE);
+            if(a->table == NULL) return -1;
+        }
+        a->table[VA_TO_VPN(va, 0)] = PA_TO_PTE(pa) | flags;
+    }
+    pmem_dup_pages((void*)pa, size / PAGE_SIZE);
+    __sync_fetch_and_add(&cow.nshare, size / PAGE_SIZE);
+    a->done = va + size;
+    return 0;
+}
+
+//  把old中[start, end)的映射复制到new, 物理页写时复制共享
+//  可写的页在两边都变成只读+PTE_COW, 第一次写入时由uvm_cow_fault复制
+//  大页优先以大页共享, 失败时用512个4K的PTE映射同一块物理内存
+//  只遍历old中有效的PTE, 还没有按需分配的部分整片跳过
+//  成功返回0, 失败返回-1, 已经复制到的位置放在done中
+static int uvm_copy_range(pgtbl_t old, pgtbl_t new, uint64 start, uint64 end, uint64* done)
+{
+    copy_arg_t arg = { new, end, NULL, 0, start };
+
+    if(vm_walk_range(old, start, end, false, copy_leaf, &arg) < 0) {
+        *done = arg.done;
+        return -1;
+    }
+    *done = end;
+    return 0;
 }
 
-//  拷贝页表和它管理的物理页(old->new sz字节)
+// 复制树中所有region的映射
+// 成功返回0, 失败返回-1 (已经复制的部分由uvm_uncopy_regions解除)
+static int uvm_copy_regions(pgtbl_t old, pgtbl_t new, vm_region_t* root)
+{
+    uint64 done;
+
+    if(root == NULL) return 0;
+    if(uvm_copy_range(old, new, root->start, VM_REGION_END(root), &done) < 0)
+        return -1;
+    if(uvm_copy_regions(old, new, root->left) < 0)
+        return -1;
+    return uvm_copy_regions(old, new, root->right);
+}
+
+// 解除new中所有region的映射并放弃对物理页的引用
+// 还没有复制到的部分没有PTE, 遍历时直接跳过
+static void uvm_uncopy_regions(pgtbl_t new, vm_region_t* root)
+{
+    if(root == NULL) return;
+    uvm_unmappages(new, root->start, root->npages, true);
+    uvm_uncopy_regions(new, root->left);
+    uvm_uncopy_regions(new, root->right);
+}
+
+//  拷贝页表(old->new sz字节), 物理页写时复制共享
 //  成功返回0,失败返回-1
-int uvm_copy_pagetable(pgtbl_t old, pgtbl_t new, uint64 sz, vm_region_t* head)
+int uvm_copy_pagetable(pgtbl_t old, pgtbl_t new, uint64 sz, vm_region_t* vm_root)
 {
-    uint64 pa, va;
-    pte_t* pte;
-    int flags, ret;
-    char* mem;
+    uint64 va;
 
     // [0, sz]区域复制
-    for(va = 0; va < sz; va += PAGE_SIZE) {
-
-        // 获得pte并进行检查
-        pte = vm_getpte(old, va, false);
-        assert(pte != NULL, "uvm_copy_pagetable: 1\n");
-        assert((*pte) & PTE_V, "uvm_copy_pagetable: 2\n");
-        assert((*pte) & (PTE_R | PTE_W | PTE_X), "uvm_copy_pagetable: 3\n");
-
-        // pte -> pa + flags
-        pa    = PTE_TO_PA(*pte);
-        flags = PTE_FLAGS(*pte);
-
-        // 申请一个新物理页并使用data page填充
-        mem = (char*)pmem_alloc_pages(1, false);
-        if(mem == NULL) goto fail;
-        memmove(mem, (const void*)pa, PAGE_SIZE);
-        
-        // 尝试映射到新的pagetable
-        ret = vm_mappages(new, va, (uint64)mem, PAGE_SIZE, flags);
-        if(ret < 0) {
-            pmem_free_pages(mem, 1, false);
-            goto fail;
+    if(uvm_copy_range(old, new, 0, ALIGN_UP(sz, PAGE_SIZE), &va) < 0)
+        goto fail;
+
+    // vm_region区域复制 (此时va = ALIGN_UP(sz))
+    if(uvm_copy_regions(old, new, vm_root) < 0) {
+        uvm_uncopy_regions(new, vm_root);
+        goto fail;
+    }
+
+    // 父进程的PTE被改成了只读
+    vm_flush_tlb(old);
+    return 0;
+
+fail:
+    // 解除[0, va)的映射并放弃对物理页的引用
+    uvm_unmappages(new, 0, va / PAGE_SIZE, true);
+    vm_flush_tlb(old);
+    return -1;
+}
+
+//  撤销uvm_copy_pagetable成功复制的映射 (fork在之后的步骤失败时使用)
+//  new中[0, sz)和vm_root中所有区域的映射都被解除, 放弃对物理页的引用, 只剩空的页表
+void uvm_uncopy_pagetable(pgtbl_t new, uint64 sz, vm_region_t* vm_root)
+{
+    uvm_unmappages(new, 0, ALIGN_UP(sz, PAGE_SIZE) / PAGE_SIZE, true);
+    uvm_uncopy_regions(new, vm_root);
+}
+
+/*
+    写时复制缺页: 让va所在的页变成私有可写的
+    页已经没有其他共享者时直接恢复可写, 否则复制一份
+    大页申请不到连续内存时先拆成4K页
+    成功返回0, va不是写时复制页或内存不足返回-1
+*/
+int uvm_cow_fault(pgtbl_t pagetable, uint64 va)
+{
+    int level;
+
+    if(va >= VA_MAX) return -1;
+    pte_t* pte = vm_getleaf(pagetable, va, &level);
+    if(pte == NULL || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+        return -1;
+
+    uint64 size = VM_LEVEL_SIZE(level);
+    uint64 pa = PTE_TO_PA(*pte);
+    int flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    if(!pmem_shared((void*)pa, size / PAGE_SIZE)) {
+        // 只剩自己在用
+        *pte = PA_TO_PTE(pa) | flags;
+        __sync_fetch_and_add(&cow.nreuse, 1);
+    } else {
+        void* mem;
+        if(pa == zero_pa) mem = pmem_alloc_zeroed(false); // 零页不用复制
+        else mem = pmem_alloc_pages(size / PAGE_SIZE, false);
+        if(mem == NULL) {
+            if(level == 0 || uvm_split_mega(pagetable, va) < 0) return -1;
+            return uvm_cow_fault(pagetable, va);
         }
+        if(pa != zero_pa) memmove(mem, (void*)pa, size);
+        *pte = PA_TO_PTE(mem) | flags;
+        pmem_free_pages((void*)pa, size / PAGE_SIZE, false); // 放弃对原页的引用
+        __sync_fetch_and_add(&cow.ncopy, 1);
     }
+    vm_flush_page(pagetable, va);
+    return 0;
+}
+
+// 写时复制的统计信息
+void uvm_cow_stat(cow_stat_t* st)
+{
+    *st = cow;
+}
 
-    // vm_region区域复制
-    vm_region_t* tmp = head;
-    while(tmp != NULL) {
-        for(int i = 0; i < tmp->npages; i++) {
-            va = tmp->start + i * PAGE_SIZE;
-            pte = vm_getpte(old, va, false);
-            assert(pte != NULL, "uvm_copy_pagetable: 4\n");
-            assert((*pte) & PTE_V, "uvm_copy_pagetable: 5\n");
-            assert((*pte) & (PTE_R | PTE_W | PTE_X), "uvm_copy_pagetable: 6\n");
-            
-            pa    = PTE_TO_PA(*pte);
-            flags = PTE_FLAGS(*pte);
-            mem = pmem_alloc_pages(1, false);
-            assert(mem != NULL, "uvm_copy_pagetable: 7");
-            memmove(mem, (const void*)pa, PAGE_SIZE);
-            assert(vm_mappages(new, va, (uint64)mem, PAGE_SIZE, flags) == 0, "uvm_copy_pagetable: 8");
+/*
+    找到va所在的区域, 结果放在area中
+    [0, ustack-4K)      程序映像, exec时全部映射
+    [ustack-4K, ustack) 用户栈下面的保护页
+    [ustack, heap)      用户栈, 按需分配
+    [heap, sz)          brk堆, 按需分配
+    mmap区域            匿名或文件映射
+*/
+static void uvm_find_area(proc_t* p, uint64 va, vm_area_t* area)
+{
+    area->region = NULL;
+    area->perm = PTE_R | PTE_W | PTE_U;
+
+    if(va < p->sz) {
+        if(p->ustack == 0 || va < p->ustack - PAGE_SIZE) {
+            area->type = (va < p->heap) ? VM_AREA_IMAGE : VM_AREA_ANON;
+            area->start = (va < p->heap) ? 0 : p->heap;
+            area->end = (va < p->heap) ? p->heap : p->sz;
+        } else if(va < p->ustack) {
+            area->type = VM_AREA_GUARD;
+            area->start = p->ustack - PAGE_SIZE;
+            area->end = p->ustack;
+        } else if(va < p->heap) {
+            area->type = VM_AREA_STACK;
+            area->start = p->ustack;
+            area->end = p->heap;
+        } else {
+            area->type = VM_AREA_ANON;
+            area->start = p->heap;
+            area->end = p->sz;
         }
-        tmp = tmp->next;
+        return;
+    }
+    vm_region_t* region = uvm_region_find(p->vm_root, va);
+    if(region != NULL) {
+        area->type = (region->flags & MAP_ANONYMOUS) ? VM_AREA_ANON : VM_AREA_FILE;
+        area->start = region->start;
+        area->end = VM_REGION_END(region);
+        area->perm = region->perm;
+        area->region = region;
+        return;
     }
+    area->type = VM_AREA_NONE;
+}
 
+// 在va处映射零页, 权限中的PTE_W换成PTE_COW
+// 成功返回0, 申请页表失败返回-1
+static int uvm_map_zero(pgtbl_t pagetable, uint64 va, int perm)
+{
+    if(perm & PTE_W)
+        perm = (perm & ~PTE_W) | PTE_COW;
+    pmem_dup_pages((void*)zero_pa, 1);
+    if(vm_mappages(pagetable, va, zero_pa, PAGE_SIZE, perm) < 0) {
+        pmem_free_pages((void*)zero_pa, 1, false);
+        return -1;
+    }
     return 0;
+}
 
-fail:
-    // 解除所有映射并释放对应物理页
-    uvm_unmappages(new, 0, va / PAGE_SIZE, true);
+/*
+    各类区域的缺页处理函数, va所在的页还没有映射
+    access是这次访问需要的权限(PTE_R/PTE_W/PTE_X)
+    返回VM_FAULT_MINOR/VM_FAULT_MAJOR, 失败返回-1
+*/
+typedef int (*fault_handler_t)(proc_t* p, vm_area_t* area, uint64 va, int access);
+
+// 不属于任何区域/程序映像中的空洞
+static int fault_none(proc_t* p, vm_area_t* area, uint64 va, int access)
+{
     return -1;
 }
 
+// 保护页: 用户栈溢出
+static int fault_guard(proc_t* p, vm_area_t* area, uint64 va, int access)
+{
+    printf("pid %d: user stack overflow at %p\n", p->pid, va);
+    return -1;
+}
+
+// 申请一个清零的页, 按area->perm映射到va
+static int fault_alloc(proc_t* p, vm_area_t* area, uint64 va)
+{
+    void* mem = pmem_alloc_zeroed(false);
+    if(mem == NULL) return -1;
+    if(vm_mappages(p->pagetable, va, (uint64)mem, PAGE_SIZE, area->perm) < 0) {
+        pmem_free_pages(mem, 1, false);
+        return -1;
+    }
+    __sync_fetch_and_add(&lazy.nalloc, 1);
+    return VM_FAULT_MINOR;
+}
+
+// 用户栈: 栈页总是会被写, 直接申请清零的页
+static int fault_stack(proc_t* p, vm_area_t* area, uint64 va, int access)
+{
+    if((area->perm & access) == 0) return -1;
+    return fault_alloc(p, area, va);
+}
+
+// 匿名内存: 读和执行映射零页, 写申请清零的页(整个2M区间都空着时尝试大页)
+// MAP_SHARED的匿名页带PTE_SHA, fork后父子进程共享, 所以读时也直接申请
+static int fault_anon(proc_t* p, vm_area_t* area, uint64 va, int access)
+{
+    int level;
+    uint64 blk = ALIGN_DOWN(va, VM_MEGA_SIZE);
+
+    if((area->perm & access) == 0) return -1;
+    bool shared = area->region && (area->region->flags & MAP_SHARED);
+    if(shared)
+        area->perm |= PTE_SHA;
+    if(access != PTE_W && !shared) {
+        if(uvm_map_zero(p->pagetable, va, area->perm) < 0) return -1;
+        __sync_fetch_and_add(&lazy.nzero, 1);
+        return VM_FAULT_MINOR;
+    }
+    // vm_getleaf返回NULL: 这个2M区间还没有L0页表, 也就没有任何4K映射
+    if(blk >= area->start && blk + VM_MEGA_SIZE <= area->end &&
+       vm_getleaf(p->pagetable, va, &level) == NULL && thp_map(p->pagetable, blk, area->perm)) {
+        __sync_fetch_and_add(&lazy.nalloc, VM_MEGA_NPAGES);
+        return VM_FAULT_MINOR;
+    }
+    return fault_alloc(p, area, va);
+}
+
+/*
+    文件映射: 从inode的页缓存映射
+    MAP_SHARED直接映射缓存页并带PTE_SHA, 写过的页(PTE_D)在msync/munmap时写回
+    MAP_PRIVATE读时映射缓存页(可写区域带PTE_COW), 写时复制一份私有页
+    缓存页需要从文件读入时是major fault
+*/
+static int fault_file(proc_t* p, vm_area_t* area, uint64 va, int access)
+{
+    vm_region_t* region = area->region;
+    uint32 index = (region->off + (va - region->start)) / PAGE_SIZE;
+    int perm = area->perm;
+    bool major;
+
+    if((perm & access) == 0) return -1;
+    ext4_inode_lock(region->ip);
+    uint64 pa = ext4_pcache_get(region->ip, index, &major);
+    ext4_inode_unlock(region->ip);
+    if(pa == 0) return -1;
+
+    if(region->flags & MAP_SHARED) {
+        perm |= PTE_SHA;
+    } else if(access == PTE_W) {
+        void* mem = pmem_alloc_pages(1, false);
+        if(mem != NULL) memmove(mem, (void*)pa, PAGE_SIZE);
+        pmem_free_pages((void*)pa, 1, false);
+        if(mem == NULL) return -1;
+        pa = (uint64)mem;
+    } else if(perm & PTE_W) {
+        perm = (perm & ~PTE_W) | PTE_COW;
+    }
+    if(vm_mappages(p->pagetable, va, pa, PAGE_SIZE, perm) < 0) {
+        pmem_free_pages((void*)pa, 1, false);
+        return -1;
+    }
+    return major ? VM_FAULT_MAJOR : VM_FAULT_MINOR;
+}
+
+static fault_handler_t fault_handlers[] = {
+    [VM_AREA_NONE]  fault_none,
+    [VM_AREA_IMAGE] fault_none,
+    [VM_AREA_GUARD] fault_guard,
+    [VM_AREA_STACK] fault_stack,
+    [VM_AREA_ANON]  fault_anon,
+    [VM_AREA_FILE]  fault_file,
+};
+
+/*
+    用户缺页的处理入口 (scause 12/13/15, 以及内核访问用户页时)
+    va所在的页已经映射: 只有对写时复制页的写可以处理
+    还没有映射: 按va所在区域的类型交给对应的处理函数
+    成功返回0并计入进程的minflt/majflt, 失败返回-1 (调用者杀死进程)
+*/
+int uvm_fault(uint64 va, int access)
+{
+    proc_t* p = myproc();
+    vm_area_t area;
+    int level, ret;
+
+    if(va >= VA_MAX) return -1;
+    va = ALIGN_DOWN(va, PAGE_SIZE);
+    uvm_find_area(p, va, &area);
+
+    pte_t* pte = vm_getleaf(p->pagetable, va, &level);
+    if(area.type == VM_AREA_GUARD)
+        ret = fault_guard(p, &area, va, access);
+    else if(pte != NULL && ((*pte) & PTE_V))
+        ret = (access == PTE_W && uvm_cow_fault(p->pagetable, va) == 0) ? VM_FAULT_MINOR : -1;
+    else
+        ret = fault_handlers[area.type](p, &area, va, access);
+    if(ret < 0) return -1;
+
+    vm_flush_page(p->pagetable, va);
+    if(ret == VM_FAULT_MAJOR) {
+        p->majflt++;
+        __sync_fetch_and_add(&lazy.nmajor, 1);
+    } else {
+        p->minflt++;
+        __sync_fetch_and_add(&lazy.nminor, 1);
+    }
+    return 0;
+}
+
+/*
+    内核访问当前进程的用户页va之前调用
+    补上还没分配的页, 要写时打破写时复制
+    内核通过直接映射访问, 不经过PTE的权限检查, 所以要写的页必须带PTE_W或PTE_COW
+    (只读页可能是零页/页缓存页/fork后共享的页, 写入会影响其他进程或文件)
+    成功返回0, 失败返回-1
+*/
+static int uvm_touch(pgtbl_t pagetable, uint64 va, bool write)
+{
+    int level;
+    pte_t* pte = vm_getleaf(pagetable, va, &level);
+
+    if(pte != NULL && ((*pte) & PTE_V)) {
+        if(!write) return 0;
+        if((*pte) & PTE_W) {
+            *pte |= PTE_D; // 内核通过直接映射写, 硬件不会设置PTE_D
+            return 0;
+        }
+        if(((*pte) & PTE_COW) == 0) return -1; // 只读页
+    }
+    proc_t* p = myproc();
+    if(p == NULL || p->pagetable != pagetable) return -1;
+    return uvm_fault(va, write ? PTE_W : PTE_R);
+}
+
+// 按需分配的统计信息
+void uvm_lazy_stat(lazy_stat_t* st)
+{
+    *st = lazy;
+}
+
 //  解除进程[0,sz)的地址映射并释放data pages
 //  然后销毁页表 (释放地址空间)
-void uvm_free(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_head)
+void uvm_free(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_root)
 {
-    vm_region_t *tmp = vm_head, *next = NULL;
-    
     // 解除映射并释放物理页
     if(sz != 0) 
         uvm_unmappages(pagetable, 0, ALIGN_UP(sz, PAGE_SIZE) / PAGE_SIZE, true);
-    while (tmp) {
-        next = tmp->next;
-        uvm_region_free(pagetable, tmp);
-        tmp = next;
-    }
+    uvm_free_regions(pagetable, vm_root);
 
     // 销毁页表
     uvm_free_pagetable(pagetable);
@@ -217,7 +678,7 @@ void uvm_map_initcode(pgtbl_t pagetable, unsigned char* src, uint32 sz)
 
     for(begin = 0; begin < sz; begin += PAGE_SIZE) {
         // 申请一个用户地址空间的物理页
-        mem = (char*)pmem_alloc_pages(1, false);
+        mem = (char*)pmem_alloc_zeroed(false);
         assert(mem != NULL, "uvm_map_initcode: 2\n"); 
         
         // 数据转移
@@ -230,7 +691,7 @@ void uvm_map_initcode(pgtbl_t pagetable, unsigned char* src, uint32 sz)
         "uvm_map_initcode: 3\n");
     }
     // 栈空间
-    mem = (char*)pmem_alloc_pages(1, false);
+    mem = (char*)pmem_alloc_zeroed(false);
     assert(mem != NULL, "uvm_map_initcode: 4\n"); 
     vm_mappages(pagetable, begin, (uint64)mem, PAGE_SIZE, PTE_R|PTE_W|PTE_U);
 }
@@ -239,6 +700,7 @@ void uvm_map_initcode(pgtbl_t pagetable, unsigned char* src, uint32 sz)
 //  在exec.c->main中用于建立屏障
 void uvm_clear_PTEU(pgtbl_t pagetable, uint64 va)
 {
+    assert(uvm_split_mega(pagetable, va) == 0, "uvm.c->uvm_clear_PTEU\n");
     pte_t* pte = vm_getpte(pagetable, va, false);
     assert(pte != NULL, "uvm.c->uvm_clear_PTEU\n");
     *pte = *pte & (~PTE_U);
@@ -256,13 +718,18 @@ uint64 uvm_grow(pgtbl_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
     char* mem;
     oldsz = ALIGN_UP(oldsz, PAGE_SIZE);
     for(uint64 cur_page = oldsz; cur_page < newsz; cur_page += PAGE_SIZE) {
+        // 覆盖了一个完整的2M区间: 尝试使用大页
+        if(cur_page % VM_MEGA_SIZE == 0 && cur_page + VM_MEGA_SIZE <= newsz &&
+           thp_map(pagetable, cur_page, PTE_U | xperm)) {
+            cur_page += VM_MEGA_SIZE - PAGE_SIZE;
+            continue;
+        }
         // 申请物理页,失败则撤回前面的工作
-        mem = pmem_alloc_pages(1, false);
+        mem = pmem_alloc_zeroed(false);
         if(mem == NULL) {
             uvm_ungrow(pagetable, cur_page, oldsz);
             return 0;
         }
-        memset(mem, 0, PAGE_SIZE);
         // 页表映射,失败则撤回前面的工作
         if(vm_mappages(pagetable, cur_page, (uint64)mem, PAGE_SIZE, PTE_U | xperm) < 0) {
             pmem_free_pages(mem, 1, false); // 其他alloc的物理页由uvm_ungrow负责释放
@@ -273,6 +740,17 @@ uint64 uvm_grow(pgtbl_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
     return newsz;
 }
 
+//  brk: 把进程的堆从oldsz扩展到newsz, 只保留地址范围
+//  物理页在第一次访问时由uvm_fault分配
+//  成功返回newsz, 和mmap区域冲突时返回oldsz
+uint64 uvm_grow_lazy(uint64 oldsz, uint64 newsz)
+{
+    if(newsz <= oldsz) return oldsz;
+    if(newsz > VM_MMAP_START) return oldsz;
+    __sync_fetch_and_add(&lazy.nreserve, ALIGN_UP(newsz, PAGE_SIZE) / PAGE_SIZE - ALIGN_UP(oldsz, PAGE_SIZE) / PAGE_SIZE);
+    return newsz;
+}
+
 //  基于页表解除一部分物理页的映射并释放它们
 //  使得进程控制的物理内存大小从oldsz缩减到newsz
 //  成功返回newsz, 失败返回oldsz
@@ -335,6 +813,8 @@ int uvm_copyout(pgtbl_t pagetable, uint64 dst, uint64 src, uint64 len)
     while (len > 0) {
         // 虚拟地址->物理地址
         va0 = ALIGN_DOWN(dst, PAGE_SIZE);
+        // 按需分配的页先补上, 写时复制页先变成私有的
+        if(uvm_touch(pagetable, va0, true) < 0) return -1;
         pa0 = uvm_getpa(pagetable, va0);
         if(pa0 == 0) return -1;
         // 确认本次迁移的长度
@@ -359,6 +839,7 @@ int uvm_copyin(pgtbl_t pagetable, uint64 dst, uint64 srcva, uint64 len)
     while (len > 0) {
         // 虚拟地址->物理地址
         va0 = ALIGN_DOWN(srcva, PAGE_SIZE);
+        if(uvm_touch(pagetable, va0, false) < 0) return -1;
         pa0 = uvm_getpa(pagetable,va0);
         if(pa0 == 0) return -1;
         // 确认本次迁移的长度
@@ -385,6 +866,7 @@ int uvm_copyin2(pgtbl_t pagetable, char* dst, uint64 srcva, uint64 maxlen)
     while(!get_null && maxlen > 0) {
     
         va0 = ALIGN_DOWN(srcva, PAGE_SIZE);
+        if(uvm_touch(pagetable, va0, false) < 0) return -1;
         pa0 = uvm_getpa(pagetable, va0);
         if(pa0 == 0) return -1;
 
@@ -409,19 +891,28 @@ int uvm_copyin2(pgtbl_t pagetable, char* dst, uint64 srcva, uint64 maxlen)
     return get_null ? 0 : -1;
 }
 
+// [start, start+size)是否在mmap的地址范围内并且没有被占用
+static bool uvm_range_free(proc_t* p, uint64 start, uint64 size)
+{
+    if(start < VM_MMAP_START || start + size > VM_MMAP_END) return false;
+    vm_region_t* region = uvm_region_first(p->vm_root, start);
+    return region == NULL || region->start >= start + size;
+}
+
 // sys_mmap的实现
+// 没有MAP_FIXED时start只是提示, 被占用时在mmap范围内first-fit查找空闲地址
 // 成功返回已映射区域的指针, 失败返回-1
 uint64 uvm_mmap(uint64 start, int len, int prot, int flags, int fd, int off)
 {
     // printf("uvm_mmap: start = %p, len = %d, prot = %d, flags = %d, fd = %d, off = %d\n", 
     //        start, len, prot, flags, fd, off);
     proc_t* p = myproc();
-    vm_region_t* vm_region = uvm_region_alloc();
+    vm_region_t* vm_region;
+    ext4_file_t* file = NULL;
     int perm = PTE_U;
-    uint64 pa, va, ret = p->vm_allocable;
+    uint64 size, align = PAGE_SIZE;
 
     if(prot == PROT_NONE) return -1;
-    // assert(prot != PROT_NONE, "uvm_mmap: -1");
 
     if(prot & PROT_READ)
         perm |= PTE_R;
@@ -430,190 +921,142 @@ uint64 uvm_mmap(uint64 start, int len, int prot, int flags, int fd, int off)
     if(prot & PROT_EXEC)
         perm |= PTE_X;
 
-    //printf("uvm_mmap: start = %p, len = %d, prot = %d, flags = %d, fd = %d, off = %d\n", start, len, prot, flags, fd, off);
-    
-    assert(start == 0, "uvm_mmap: 0");
-    //assert(flags & MAP_SHARED, "uvm_mmap: 1");
-    
     // 确保至少映射一个页面，即使长度为0
     if(len <= 0) len = PAGE_SIZE;
     len = ALIGN_UP(len, PAGE_SIZE) / PAGE_SIZE;
-    // printf("%d\n", len);
+    size = (uint64)len * PAGE_SIZE;
 
-    spinlock_acquire(&p->lk);
-    if(flags & MAP_ANONYMOUS) { // 匿名映射
-
-        vm_region->start = p->vm_allocable;
-        vm_region->npages = len;
-        vm_region->flags = flags;
-        if(p->vm_head) {
-            vm_region->next = p->vm_head->next;
-            p->vm_head->next = vm_region;
-        } else {
-            vm_region->next = NULL;
-            p->vm_head = vm_region;
-        }
-
-        for(int i = 0; i < len; i++) {
-            pa = (uint64)pmem_alloc_pages(1, false);
-            if(pa == 0) goto fail;
-            va = p->vm_allocable;
-            p->vm_allocable += PAGE_SIZE;
-            if(vm_mappages(p->pagetable, va, pa, PAGE_SIZE, perm) < 0) goto fail;
-        }
-    } else {                    // 文件映射
-        // 验证文件描述符
-        if(fd < 0 || fd >= NOFILE || p->ext4_ofile[fd] == NULL) {
-            // printf("uvm_mmap: invalid file descriptor fd=%d (NOFILE=%d, ofile=%p)\n", 
-            //        fd, NOFILE, fd >= 0 && fd < NOFILE ? p->ext4_ofile[fd] : NULL);
-            goto fail;
-        }
-        
-        ext4_file_t* file = p->ext4_ofile[fd];
-        //printf("uvm_mmap: file mapping, fd=%d, file->ip->size=%d\n", fd, file->ip->size);
-        
-        // 使用现有的vm_region分配函数
-        vm_region->start = p->vm_allocable;
-        vm_region->npages = len;
-        vm_region->flags = flags;
-        
-        // 添加到进程的vm_region链表
-        if(p->vm_head != NULL) {
-            vm_region->next = p->vm_head->next;
-            p->vm_head->next = vm_region;
-        } else {
-            vm_region->next = NULL;
-            p->vm_head = vm_region;
-        }
+    if((flags & MAP_ANONYMOUS) == 0) { // 文件映射
+        // 验证文件描述符和偏移
+        if(fd < 0 || fd >= NOFILE || p->ext4_ofile[fd] == NULL || off < 0 || off % PAGE_SIZE != 0)
+            return -1;
+        file = p->ext4_ofile[fd];
+        if(file->file_type != TYPE_REGULAR) return -1;
+        // 可写的共享映射会写回文件, 文件需要以可写方式打开
+        if((flags & MAP_SHARED) && (prot & PROT_WRITE) && (file->oflags & FLAGS_MASK) == FLAGS_RDONLY)
+            return -1;
+    } else if(len >= VM_MEGA_NPAGES) {
+        // 足够大的匿名映射按2M对齐, 以便使用大页
+        align = VM_MEGA_SIZE;
+    }
 
-        // 为每个页面分配物理内存并读取文件内容
-        for(int i = 0; i < len; i++) {
-            pa = (uint64)pmem_alloc_pages(1, false);
-            if(pa == 0) goto fail;
-            
-            va = p->vm_allocable;
-            p->vm_allocable += PAGE_SIZE;
-            
-            // 从文件读取数据到物理页面
-            uint64 file_offset = off + i * PAGE_SIZE;
-            uint32 read_size = PAGE_SIZE;
-            
-            // 如果是文件末尾，可能读取不足一页的数据
-            if(file_offset + PAGE_SIZE > file->ip->size) {
-                if(file_offset >= file->ip->size) {
-                    read_size = 0;  // 超出文件大小，填零
-                } else {
-                    read_size = file->ip->size - file_offset;
-                }
-            }
-            
-            // 清零页面
-            memset((void*)pa, 0, PAGE_SIZE);
-            
-            // 如果有数据要读取
-            if(read_size > 0) {
-                // printf("uvm_mmap: reading file %s at offset %d, size %d\n", 
-                //        file->ip->name, file_offset, read_size);
-                // 临时释放进程锁以避免死锁
-                spinlock_release(&p->lk);
-                
-                // 获取文件锁并读取文件数据
-                spinlock_acquire(&file->lk);
-                file->off = file_offset;
-                int read_result = ext4_file_read(file, pa, read_size, false);
-                // printf("uvm_mmap: read_result = %d\n", read_result);
-                spinlock_release(&file->lk);
-                
-                // 重新获取进程锁
-                spinlock_acquire(&p->lk);
-                
-                if(read_result < 0) {
-                    pmem_free_pages((void*)pa, 1, false);
-                    goto fail;
-                }
-            }
-            
-            // 映射物理页面到虚拟地址
-            if(vm_mappages(p->pagetable, va, pa, PAGE_SIZE, perm) < 0) {
-                pmem_free_pages((void*)pa, 1, false);
-                goto fail;
-            }
-        }
+    // 只有进程自己会修改region树, 不需要加锁
+    if(flags & MAP_FIXED) {
+        if(start % PAGE_SIZE != 0 || start < VM_MMAP_START || start + size > VM_MMAP_END)
+            return -1;
+        uvm_munmap(start, size); // 替换掉原有的映射
+    } else if(start % PAGE_SIZE != 0 || !uvm_range_free(p, start, size)) {
+        start = uvm_region_hole(p->vm_root, size, align);
+        if(start == 0) return -1;
     }
-    spinlock_release(&p->lk);
-    //printf("uvm_mmap: successfully mapped, returning %p (vm_allocable was %p)\n", ret, p->vm_allocable);
-    return ret;
 
-fail:
-    //printf("uvm_mmap: failed to map\n");
-    spinlock_release(&p->lk);
-    return -1;
+    // 只保留地址范围, 物理页在缺页时分配(匿名)或从页缓存映射(文件, 不改变file->off)
+    vm_region = uvm_region_alloc();
+    if(vm_region == NULL) return -1;
+    vm_region->start = start;
+    vm_region->npages = len;
+    vm_region->flags = flags;
+    vm_region->perm = perm;
+    if(file != NULL) {
+        vm_region->ip = ext4_inode_dup(file->ip);
+        vm_region->off = off;
+    } else {
+        __sync_fetch_and_add(&lazy.nreserve, len);
+    }
+    uvm_region_insert(&p->vm_root, vm_region);
+    uvm_region_merge(&p->vm_root, vm_region);
+    return start;
 }
 
 // sys_munmap的实现
+// 解除[start, start+len)中所有mmap区域的映射, 只覆盖region的一部分时先拆开
+// 文件映射先写回脏页, 释放的地址之后可以被mmap再次使用
 // 成功返回0 失败返回-1
-uint64 uvm_munmap(uint64 start, int len)
+uint64 uvm_munmap(uint64 start, uint64 len)
 {
-    // printf("uvm_munmap: start = %p, len = %d\n", start, len);
-    return 0;
     proc_t* p = myproc();
-    vm_region_t* vm_region, *vm_region_prev;
-    uint64 aligned_len = ALIGN_UP(len, PAGE_SIZE);
+    vm_region_t* vm_region;
+    uint64 end = start + ALIGN_UP(len, PAGE_SIZE);
     
-    // 参数验证
-    if(start == 0 || len <= 0) {
-        printf("uvm_munmap: invalid parameters start=%p len=%d\n", start, len);
+    // 参数验证 (end <= start: 长度溢出)
+    if(start % PAGE_SIZE != 0 || len == 0 || end <= start || end > VA_MAX) {
+        printf("uvm_munmap: invalid parameters start=%p len=%p\n", start, len);
         return -1;
     }
-    
-    //printf("uvm_munmap: trying to unmap start=%p len=%d aligned_len=%p\n", start, len, aligned_len);
-    
-    spinlock_acquire(&p->lk);
-    
-    // 查找匹配的vm_region
-    vm_region = p->vm_head;
-    vm_region_prev = NULL;
-    
-    //("uvm_munmap: searching regions...\n");
-    while(vm_region != NULL) {
-        //printf("uvm_munmap: found region start=%p npages=%d size=%p\n", 
-              // vm_region->start, vm_region->npages, vm_region->npages * PAGE_SIZE);
-        if(vm_region->start == start && vm_region->npages * PAGE_SIZE == aligned_len) {
-            // 找到匹配的region，从链表中移除
-            // printf("uvm_munmap: found matching region, removing it\n");
-            if(vm_region_prev == NULL) {
-                // 这是第一个region
-                p->vm_head = vm_region->next;
-            } else {
-                // 不是第一个region
-                vm_region_prev->next = vm_region->next;
-            }
-            
-            // 释放region及其管理的物理页
-            uvm_region_free(p->pagetable, vm_region);
-            
-            spinlock_release(&p->lk);
-            //printf("uvm_munmap: successfully unmapped\n");
-            return 0;
-        }
-        
-        vm_region_prev = vm_region;
-        vm_region = vm_region->next;
+
+    // 只有进程自己会修改region树 (写回文件可能睡眠)
+    while((vm_region = uvm_region_first(p->vm_root, start)) != NULL && vm_region->start < end) {
+        if(vm_region->start < start &&
+           (vm_region = uvm_region_split(&p->vm_root, vm_region, start)) == NULL)
+            return -1;
+        if(VM_REGION_END(vm_region) > end && uvm_region_split(&p->vm_root, vm_region, end) == NULL)
+            return -1;
+        uvm_region_remove(&p->vm_root, vm_region);
+        uvm_region_free(p->pagetable, vm_region); // 解除映射时已经刷新了TLB
     }
-    
-    // 没有找到匹配的region
-    //printf("uvm_munmap: no matching region found\n");
-    spinlock_release(&p->lk);
-    return -1;
+    return 0;
+}
+
+// sys_msync的实现
+// 把[start, start+len)中共享文件映射被写过的页写回文件
+// 成功返回0 失败返回-1
+uint64 uvm_msync(uint64 start, int len)
+{
+    proc_t* p = myproc();
+    uint64 end = start + ALIGN_UP(len, PAGE_SIZE);
+    vm_region_t* tmp;
+
+    if(start % PAGE_SIZE != 0 || len < 0) return -1;
+
+    // 只有进程自己会修改region树
+    for(uint64 va = start; (tmp = uvm_region_first(p->vm_root, va)) != NULL && tmp->start < end;
+        va = VM_REGION_END(tmp)) {
+        if(tmp->ip != NULL)
+            uvm_region_sync(p->pagetable, tmp, max(start, tmp->start), min(end, VM_REGION_END(tmp)));
+    }
+    return 0;
+}
+
+// uvm_protect的遍历参数
+typedef struct protect_arg {
+    uint64 end;
+    int perm;
+} protect_arg_t;
+
+static int protect_leaf(pte_t* pte, uint64 va, int level, void* arg)
+{
+    protect_arg_t* a = arg;
+    uint64 size = VM_LEVEL_SIZE(level);
+    int flags = a->perm;
+
+    // 只覆盖大页的一部分: 先拆成4K页, 遍历接着进入拆出的页表
+    if(level > 0 && (va % size != 0 || va + size > a->end))
+        return thp_split(pte);
+
+    // 被共享的页不能直接可写, 改成写时复制
+    if((flags & PTE_W) && (*pte & PTE_SHA) == 0 && pmem_shared((void*)PTE_TO_PA(*pte), size / PAGE_SIZE))
+        flags = (flags & ~PTE_W) | PTE_COW;
+    *pte = ((*pte) & ~(PTE_V | PTE_R | PTE_W | PTE_X | PTE_U | PTE_COW)) | flags;
+    return 0;
 }
 
 // 改变页面权限
+// mmap区域在边界处拆开并记录新权限, 之后和相邻的同类region合并
+// brk堆和用户栈还没分配的页先映射成零页, 然后一次遍历修改所有已映射的PTE
+// 只覆盖大页的一部分时先把它拆成4K页
 // 成功返回0 失败返回-1
 uint64 uvm_protect(uint64 start, int len, int prot)
 {
-    pgtbl_t pagetable = myproc()->pagetable;
-    pte_t* pte = NULL;
+    proc_t* p = myproc();
+    pgtbl_t pagetable = p->pagetable;
+    vm_region_t* region;
     int perm = PTE_V;
+    int level;
+    vm_area_t area;
+    uint64 va, end = start + ALIGN_UP(len, PAGE_SIZE);
+    uint64 psz = ALIGN_UP(p->sz, PAGE_SIZE);
+
+    if(start % PAGE_SIZE != 0 || len < 0 || end > VA_MAX) return -1;
 
     if(prot != PROT_NONE) {
         perm |= PTE_U;
@@ -623,14 +1066,53 @@ uint64 uvm_protect(uint64 start, int len, int prot)
             perm |= PTE_W;
         if(prot & PROT_EXEC)
             perm |= PTE_X;
+    } else {
+        perm |= PTE_R; // 保持叶子PTE, 去掉PTE_U使用户不可访问
     }
 
-    for(uint64 page = start; page < start + len; page += PAGE_SIZE)
-    {
-        pte = vm_getpte(pagetable, page, false);
-        assert(pte != NULL, "uvm_protect: 0"); 
-        *pte = ((*pte) & (0xFFFFFFE0)) & perm;
+    // sz以上的部分必须都被mmap区域覆盖
+    for(va = max(start, psz); va < end; va = VM_REGION_END(region))
+        if((region = uvm_region_find(p->vm_root, va)) == NULL)
+            return -1;
+
+    // brk堆和用户栈没有记录权限, 还没分配的页先映射零页再按新权限修改
+    for(va = start; va < min(end, psz); va += PAGE_SIZE) {
+        if(vm_getleaf(pagetable, va, &level) != NULL) continue;
+        uvm_find_area(p, va, &area);
+        if(area.type != VM_AREA_ANON && area.type != VM_AREA_STACK) return -1;
+        if(uvm_map_zero(pagetable, va, PTE_U | PTE_R) < 0) return -1;
     }
-    
-    return 0;
-}
\ No newline at end of file
+
+    // mmap区域在边界处拆开 (只有进程自己会修改region树)
+    int ret = 0;
+    for(va = start; (region = uvm_region_first(p->vm_root, va)) != NULL && region->start < end;
+        va = VM_REGION_END(region)) {
+        if(region->start < start && (region = uvm_region_split(&p->vm_root, region, start)) == NULL) {
+            ret = -1;
+            goto merge;
+        }
+        if(VM_REGION_END(region) > end && uvm_region_split(&p->vm_root, region, end) == NULL) {
+            ret = -1;
+            goto merge;
+        }
+    }
+
+    protect_arg_t arg = { end, perm };
+    ret = vm_walk_range(pagetable, start, end, false, protect_leaf, &arg);
+    vm_flush_tlb(pagetable);
+
+    // 遍历成功后才记录新权限, mmap区域还没映射的页缺页时按region->perm映射
+    if(ret == 0) {
+        for(va = start; (region = uvm_region_first(p->vm_root, va)) != NULL && region->start < end;
+            va = VM_REGION_END(region))
+            region->perm = (prot == PROT_NONE) ? 0 : (perm & ~PTE_V);
+    }
+
+merge:
+    // 权限相同的相邻区域重新合并 (失败时合并回拆开之前的样子)
+    for(va = start; (region = uvm_region_first(p->vm_root, va)) != NULL && region->start < end;
+        va = VM_REGION_END(region))
+        region = uvm_region_merge(&p->vm_root, region);
+
+    return ret < 0 ? -1 : 0;
+}
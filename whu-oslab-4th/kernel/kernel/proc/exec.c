@@ -16,6 +16,9 @@
     aux[index++] = id; \
     aux[index++] = val;
 
+// loadseg每次预读的字节数 (一个预读窗口)
+#define SEG_RA_BYTES (RA_MAX * PAGE_SIZE)
+
 #ifdef FS_FAT32
 
 static int loadseg(pgtbl_t pagetable, uint64 va, fat32_inode_t* ip, uint32 offset, uint32 sz)
@@ -23,6 +26,8 @@ static int loadseg(pgtbl_t pagetable, uint64 va, fat32_inode_t* ip, uint32 offse
     uint64 pa;
     int n, ret;
     for(int i = 0; i < sz; i += PAGE_SIZE) {
+        if(i % SEG_RA_BYTES == 0) // 段内容是顺序读取的, 每次预读一个窗口
+            fat32_inode_readahead(ip, offset + i, min(sz - i, SEG_RA_BYTES));
         pa = uvm_getpa(pagetable, va + i);
         assert(pa != 0, "exec.c->loadseg");
         n = min(sz - i, PAGE_SIZE);
@@ -40,6 +45,8 @@ static int loadseg(pgtbl_t pagetable, uint64 va, ext4_inode_t* ip, uint32 offset
     int n, ret;
     assert(va % PAGE_SIZE == 0, "loadseg: 0");
     for(int i = 0; i < sz; i += PAGE_SIZE) {
+        if(i % SEG_RA_BYTES == 0) // 段内容是顺序读取的, 每次预读一个窗口
+            ext4_inode_readahead(ip, offset + i, min(sz - i, SEG_RA_BYTES));
         pa = uvm_getpa(pagetable, va + i);
         assert(pa != 0, "loadseg: 1");
         n = min(sz - i, PAGE_SIZE);
@@ -231,14 +238,14 @@ int proc_exec(char* path, char** argv, char** envp)
 
     pgtbl_t old_pgtbl = p->pagetable;
     uint64 oldsz = p->sz;
-    vm_region_t* old_vm_head = p->vm_head;
-    proc_destroy_pagetable(old_pgtbl, oldsz, old_vm_head);
+    vm_region_t* old_vm_root = p->vm_root;
+    proc_destroy_pagetable(old_pgtbl, oldsz, old_vm_root);
 
 /* -------------------动态链接处理----------------------*/
     // 由于动态链接要用到mmap 所以mmap相关初始化放在这边
     p->pagetable = new_pgtbl;
-    p->vm_allocable = VM_MMAP_START;
-    p->vm_head = NULL;
+    p->vm_root = NULL;
+    p->asid = 0; // 旧页表的TLB项留在旧ASID下, 新页表回到用户态时分配新的ASID
     uint64 start_addr = 0;
 
     is_dynamic = false;
@@ -268,12 +275,16 @@ int proc_exec(char* path, char** argv, char** envp)
 
 /*--------------------动态链接结束----------------------*/
 
-    // 准备11个页面,低地址页面作为缓冲地带,高地址10个页面存放user-stack
+    // 准备32个页面,低地址页面作为缓冲地带,高地址31个页面存放user-stack
+    // 参数和环境变量只占最高的一页, 先映射好, 其余的栈页在缺页时分配
     sz = ALIGN_UP(sz, PAGE_SIZE);
-    uret = uvm_grow(new_pgtbl, sz, sz + 32 * PAGE_SIZE, PTE_W | PTE_R);
+    uint64 guard = sz;
+    uret = uvm_grow(new_pgtbl, sz, sz + PAGE_SIZE, PTE_W | PTE_R);
+    if(uret == 0) goto bad;
+    sz += 32 * PAGE_SIZE;
+    uret = uvm_grow(new_pgtbl, sz - PAGE_SIZE, sz, PTE_W | PTE_R);
     if(uret == 0) goto bad;
-    sz = uret;
-    uvm_clear_PTEU(new_pgtbl, sz - 32 * PAGE_SIZE); // 缓冲页面在用户态不可访问
+    uvm_clear_PTEU(new_pgtbl, guard); // 缓冲页面在用户态不可访问
 
     // 填充参数到stack
     uint64 ustack[NARG], estack[NENV];
@@ -360,6 +371,8 @@ int proc_exec(char* path, char** argv, char** envp)
     p->tf->a1 = sp;
 
     p->sz = sz;
+    p->ustack = guard + PAGE_SIZE;
+    p->heap = sz;
     p->tf->epc = program_entry;
     p->tf->sp = sp;
 
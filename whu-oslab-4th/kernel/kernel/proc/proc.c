@@ -34,9 +34,10 @@ static spinlock_t pid_lock;
 
 // 辅助函数声明
 static int alloc_pid();
-static proc_t* alloc_proc();
+static proc_t* alloc_proc(bool user);
 static void free_proc(proc_t* p);
 void forkret(void);
+static void kthread_entry(void);
 
 /* --------------------------------------辅助函数----------------------------------- */
 
@@ -53,10 +54,11 @@ static int alloc_pid()
 
 /* 
     在procs列表中寻找一个未被使用的空间
+    user为false时是内核线程, 不申请trapframe和用户页表
     若成功则返回这个可用的proc,若失败则返回NULL
     注意:若成功执行,得到的空闲proc是上了锁的
 */
-static proc_t* alloc_proc()
+static proc_t* alloc_proc(bool user)
 {
     proc_t* p;
 
@@ -70,15 +72,16 @@ static proc_t* alloc_proc()
 
 success:
 
-    // 申请一页作为trapframe的物理地址空间
-    p->tf = (trapframe_t*)pmem_alloc_pages(1, true);
-    if(p->tf == NULL) goto fail;
+    if(user) {
+        // 申请一页作为trapframe的物理地址空间
+        p->tf = (trapframe_t*)pmem_alloc_zeroed(true);
+        if(p->tf == NULL) goto fail;
 
-    // 申请一个pagetable并完成trapframe和trampoline的映射
-    p->pagetable = proc_alloc_pagetable(p);
-    if(p->pagetable == NULL) goto fail;
-    p->vm_allocable = VM_MMAP_START;
-    p->vm_head = NULL;
+        // 申请一个pagetable并完成trapframe和trampoline的映射
+        p->pagetable = proc_alloc_pagetable(p);
+        if(p->pagetable == NULL) goto fail;
+    }
+    p->vm_root = NULL;
     
     // 设置上下文
     memset(&p->ctx, 0, sizeof(p->ctx)); 
@@ -112,7 +115,7 @@ static void free_proc(proc_t* p)
         p->tf = NULL;
     }
     if(p->pagetable) { 
-        proc_destroy_pagetable(p->pagetable, p->sz, p->vm_head);
+        proc_destroy_pagetable(p->pagetable, p->sz, p->vm_root);
         p->pagetable = NULL;
     }
     p->pid = 0;
@@ -120,12 +123,19 @@ static void free_proc(proc_t* p)
     
     // 其他字段的清零
     p->sz = 0;
-    p->vm_head = NULL;
-    p->vm_allocable = 0;
+    p->ustack = 0;
+    p->heap = 0;
+    p->minflt = 0;
+    p->majflt = 0;
+    p->vm_root = NULL;
+    p->asid = 0;
+    p->asid_cpu = 0;
     p->parent = NULL;
     p->channel = NULL;
     p->killed = false;
     p->exit_state = 0;
+    p->kthread = NULL;
+    p->bio_plug = 0;
 }
 
 
@@ -155,6 +165,18 @@ void forkret(void)
 }
 
 
+/*
+    内核线程的第一次调度从这里开始
+    解锁后执行入口函数, 入口函数不应返回
+*/
+static void kthread_entry(void)
+{
+    proc_t* p = myproc();
+    spinlock_release(&p->lk);
+    p->kthread();
+    panic("proc.c->kthread_entry: kthread returned\n");
+}
+
 /*
     myproc->sz += n n可正可负 
     增加或减少进程控制的物理页
@@ -166,7 +188,7 @@ int proc_grow(int n)
     uint64 newsz = proc->sz, oldsz = proc->sz;
 
     if(n > 0) {
-        newsz = uvm_grow(proc->pagetable, oldsz, oldsz + n, PTE_W | PTE_R);
+        newsz = uvm_grow_lazy(oldsz, oldsz + n); // 物理页在缺页时分配
         if(newsz != oldsz + n) return -1;
     } else if(n < 0) {
         newsz = uvm_ungrow(proc->pagetable, oldsz, oldsz + n);
@@ -197,7 +219,8 @@ void proc_mapstacks(pgtbl_t pagetable)
         va = KSTACK((int)(p-procs));
     
         // 建立映射关系,这里的pagetable是内核页表
-        ret = vm_mappages(pagetable, va, pa, PAGE_SIZE, PTE_R | PTE_W);
+        // 内核栈在所有用户地址空间之外, 作为全局映射不占用各个ASID的TLB项
+        ret = vm_mappages(pagetable, va, pa, PAGE_SIZE, PTE_R | PTE_W | PTE_G);
         assert(ret == 0, "proc.c->proc_mapstacks: 2\n");
     }
 }
@@ -214,7 +237,8 @@ pgtbl_t proc_alloc_pagetable(proc_t* p)
 
     int ret = 0;
     // 映射trampoline区域,代码区
-    ret = vm_mappages(pagetable, TRAMPOLINE, (uint64)trampoline, PAGE_SIZE, PTE_R | PTE_X);
+    // 所有页表中trampoline的映射都相同, 作为全局映射
+    ret = vm_mappages(pagetable, TRAMPOLINE, (uint64)trampoline, PAGE_SIZE, PTE_R | PTE_X | PTE_G);
     if(ret != 0) goto fail;
 
     // 映射trapframe区域,数据区
@@ -236,13 +260,13 @@ fail:
     proc_alloc_pagetable的逆过程
     解除trapframe和trampoline的映射,释放页表
 */
-void proc_destroy_pagetable(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_head)
+void proc_destroy_pagetable(pgtbl_t pagetable, uint64 sz, vm_region_t* vm_root)
 {
     // 注意: trapframe所占物理页的释放应该在外部
     // trampoline属于代码区域根本不应释放
     uvm_unmappages(pagetable, TRAMPOLINE, 1, false);
     uvm_unmappages(pagetable, TRAPFRAME, 1, false);
-    uvm_free(pagetable, sz, vm_head);
+    uvm_free(pagetable, sz, vm_root);
 }
 
 
@@ -329,13 +353,14 @@ void proc_init()
 void proc_userinit(void)
 {
     // 创建initproc
-    initproc = alloc_proc();
+    initproc = alloc_proc(true);
     assert(initproc != NULL, "proc_userinit: 0\n");
 
     uint32 len = sizeof(initcode);
     uvm_map_initcode(initproc->pagetable, initcode, len);
 
     initproc->sz = ALIGN_UP(len, PAGE_SIZE) + PAGE_SIZE;      // 用户地址空间大小
+    initproc->heap = initproc->sz;                            // 没有保护页, 堆从sz开始
     initproc->tf->epc = 0;                                    // 返回用户态时的PC值        
     initproc->tf->sp = initproc->sz;                          // 栈指针
     initproc->state = RUNNABLE;
@@ -356,6 +381,7 @@ void proc_userinit(void)
 #else
     ext4_file_init();
     ext4_file_t* file = ext4_file_alloc();
+    assert(file != NULL, "proc_userinit: 1\n");
     file->file_type = TYPE_CHARDEV;
     file->major = CONSOLE;
     file->oflags = FLAGS_RDWR;
@@ -382,6 +408,26 @@ void proc_yield()
     spinlock_release(&proc->lk);
 }
 
+/*
+    创建一个只在内核态运行的线程, 执行fn (fn不返回)
+    它不会回到用户态, 只能通过proc_sleep主动让出CPU, 所以没有trapframe和用户页表
+    在proc_userinit之后调用, 使首进程的pid为1
+    成功返回pid, 失败返回-1
+*/
+int proc_kthread(void (*fn)(void))
+{
+    proc_t* p = alloc_proc(false);
+    if(p == NULL) return -1;
+
+    p->kthread = fn;
+    p->ctx.ra = (uint64)kthread_entry;
+    p->state = RUNNABLE;
+
+    int pid = p->pid;
+    spinlock_release(&p->lk);
+    return pid;
+}
+
 /*
     进程p创建子进程np
     p的返回值是子进程pid
@@ -391,18 +437,26 @@ void proc_yield()
 int proc_fork(uint64 stack)
 {
     proc_t* p = myproc();
-    proc_t* np = alloc_proc();
+    proc_t* np = alloc_proc(true);
     if(np == NULL) return -1;
 
     // 尝试复制p的地址空间给np
-    if(uvm_copy_pagetable(p->pagetable, np->pagetable, p->sz, p->vm_head) < 0) {    
+    if(uvm_copy_pagetable(p->pagetable, np->pagetable, p->sz, p->vm_root) < 0) {    
+        free_proc(np);
+        spinlock_release(&np->lk);
+        return -1;
+    }
+    np->vm_root = uvm_region_copy(p->vm_root);
+    if(p->vm_root != NULL && np->vm_root == NULL) {
+        // region结构体申请失败: 撤销页表的复制
+        uvm_uncopy_pagetable(np->pagetable, p->sz, p->vm_root);
         free_proc(np);
         spinlock_release(&np->lk);
         return -1;
     }
     np->sz = p->sz;
-    np->vm_allocable = p->vm_allocable;
-    np->vm_head = p->vm_head;
+    np->ustack = p->ustack;
+    np->heap = p->heap;
 
     // 复制trapframe, np的返回值设为0, 堆栈指针设为目标堆栈
     *(np->tf) = *(p->tf);
@@ -490,6 +544,10 @@ void proc_exit(int exit_state)
     p->ext4_cwd = NULL;
 #endif
 
+    // 释放mmap区域: 文件映射要写回脏页, 可能睡眠, 不能留给父进程在free_proc中做
+    uvm_free_regions(p->pagetable, p->vm_root);
+    p->vm_root = NULL;
+
     spinlock_acquire(&parent_lock);
 
     // 让p的孩子认initproc作父
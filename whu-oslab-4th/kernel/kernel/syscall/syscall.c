@@ -36,6 +36,8 @@ static uint64 (*syscalls[])(void) = {
     [SYS_fcntl]            sys_fcntl,
     [SYS_ioctl]            sys_ioctl,
     [SYS_renameat2]        sys_renameat2,
+    [SYS_sync]             sys_sync,
+    [SYS_fsync]            sys_fsync,
     // 进程操作
     [SYS_clone]            sys_clone,
     [SYS_execve]           sys_execve,
@@ -57,6 +59,7 @@ static uint64 (*syscalls[])(void) = {
     [SYS_mmap]             sys_mmap,
     [SYS_munmap]           sys_munmap,
     [SYS_mprotect]         sys_mprotect,
+    [SYS_msync]            sys_msync,
     [SYS_madvice]          sys_madvice,
     // 信号相关
     [SYS_rt_sigaction]     sys_rt_sigaction,
@@ -108,19 +111,14 @@ void syscall()
 
 static bool legal_addr(uint64 addr) {
     proc_t* p = myproc();
-    vm_region_t* vm = p->vm_head;
+    vm_region_t* vm = uvm_region_find(p->vm_root, addr);
 
     if(addr + sizeof(uint64) <= p->sz)
         return true;
-    while (vm != NULL) {
-        if(vm->start <= addr) {
-            if(vm->start + PAGE_SIZE >= addr + sizeof(uint64)) {
-                return true;
-            }
-        }
-        vm = vm->next;
-    }
-    return false;
+    // 跨越region末尾时后一段需要属于紧挨着的另一个region
+    if(vm != NULL && addr + sizeof(uint64) > VM_REGION_END(vm))
+        vm = uvm_region_find(p->vm_root, addr + sizeof(uint64) - 1);
+    return vm != NULL;
 } 
 
 // 拿到一个地址为 addr 的64位整数,让 ip 指向它
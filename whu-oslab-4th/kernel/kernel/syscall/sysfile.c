@@ -6,6 +6,7 @@
 #include "proc/proc.h"
 #include "proc/cpu.h"
 #include "lib/str.h"
+#include "fs/base_buf.h"
 
 // 文件系统操作集合
 FS_OP_t FS_OP;
@@ -678,4 +679,34 @@ uint64 sys_ppoll()
     arg_addr(2, &addr_sigmask);
 
     return FS_OP.fs_ppoll(addr_fds, nfds, addr_ts, addr_sigmask);
+}
+
+// 把所有缓存的磁盘数据写回
+// 返回0
+uint64 sys_sync()
+{
+    buf_sync();
+    return 0;
+}
+
+// 把fd对应文件的缓存数据写回
+// buf层不记录buf属于哪个文件, 这里写回全部dirty buf (包括元数据)
+// int fd 文件描述符
+// 成功返回0, 失败返回-1
+uint64 sys_fsync()
+{
+    int fd;
+    proc_t* p = myproc();
+    arg_int(0, &fd);
+    if(fd < 0 || fd >= NOFILE)
+        return -1;
+#ifdef FS_FAT32
+    if(p->fat32_ofile[fd] == NULL)
+        return -1;
+#else
+    if(p->ext4_ofile[fd] == NULL)
+        return -1;
+#endif
+    buf_sync();
+    return 0;
 }
\ No newline at end of file
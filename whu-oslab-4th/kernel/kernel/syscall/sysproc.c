@@ -6,6 +6,7 @@
 #include "lib/print.h"
 #include "signal/signal.h"
 #include "dev/timer.h"
+#include "fs/base_buf.h"
 #include "syscall/sysproc.h"
 #include "syscall/syscall.h"
 #include "sbi.h"
@@ -227,15 +228,15 @@ uint64 sys_mmap()
 
 // 取消映射(这是不完全的实现)
 // void* start  起始位置
-// int len      字节长度
+// size_t len   字节长度
 // 成功返回0 失败返回-1
 uint64 sys_munmap()
 {
     uint64 start;
-    int len;
+    uint64 len;
 
     arg_addr(0, &start);
-    arg_int(1, &len);
+    arg_addr(1, &len);
 
     return uvm_munmap(start, len);
 }
@@ -259,6 +260,22 @@ uint64 sys_mprotect()
     return uvm_protect(start, len, prot);
 } 
 
+// 把共享文件映射中被修改的页写回文件
+// void* start (page-aligned)
+// int len
+// int flags (MS_ASYNC/MS_SYNC/MS_INVALIDATE, 都按同步写回处理)
+// 成功返回0 失败返回-1
+uint64 sys_msync()
+{
+    uint64 start;
+    int len;
+
+    arg_addr(0, &start);
+    arg_int(1, &len);
+
+    return uvm_msync(start, len);
+}
+
 // 应用程序给内核关于内存的使用建议
 // 未实现
 // uint64 addr (page-aligned)
@@ -422,14 +439,20 @@ uint64 sys_sysinfo()
     uint64 addr;
     arg_addr(0, &addr);
     
+    pmem_stat_t st;
+    buf_stat_t bst;
+    pmem_stat(&st);
+    buf_stat(&bst);
+
+    // 内存以页为单位 (mem_unit = PAGE_SIZE)
     struct sysinfo sys;
     sys.uptime = CLOCK_TO_SEC(timer_mono_clock());
     sys.loads[0] = sys.loads[1] = sys.loads[2] = 0;
-    sys.totalram = 128 * 1024* 1024;
-    sys.freeram = sys.totalram / 2;
-    sys.sharedram = 4096;
-    sys.bufferram = 4096;
-    sys.totalswap = 4096;
+    sys.totalram = st.total;
+    sys.freeram = st.free + st.cached + st.zeroed;
+    sys.sharedram = 0;
+    sys.bufferram = bst.nbytes / PAGE_SIZE;
+    sys.totalswap = 0;
     sys.freeswap  = 0;
     sys.procs = NPROC;
     sys.totalhigh = 0;
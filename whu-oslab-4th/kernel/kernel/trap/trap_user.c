@@ -36,8 +36,8 @@ void trapret_user()
     // 如果发生的是系统调用,p->tf->epc会被更新,这里需要写回
     w_sepc(p->tf->epc);
 
-    // 准备参数pagetable,然后调用trampoline.S中的userret(使用它的虚拟地址)
-    uint64 satp =  MAKE_SATP(p->pagetable);
+    // 准备参数pagetable(带上进程的ASID),然后调用trampoline.S中的userret(使用它的虚拟地址)
+    uint64 satp = uvm_satp(p);
     uint64 userret_va = TRAMPOLINE + (userret - trampoline);
     
     ((void(*)(uint64))userret_va)(satp);
@@ -82,6 +82,19 @@ void trap_user(void)
                 intr_on();
                 syscall();
                 break;
+            case 12: // instruction page fault
+            case 13: // load page fault
+            case 15: { // store page fault
+                uint64 va = r_stval(); // 打开中断之前读出, 之后可能被切换走
+                int access = (cause_code == 12) ? PTE_X : (cause_code == 13) ? PTE_R : PTE_W;
+                intr_on(); // 文件映射的缺页可能要读磁盘
+                if(uvm_fault(va, access) == 0)
+                    break;
+                printf("stval = %p sepc = %p\n", va, p->tf->epc);
+                printf("User Page Fault! Code = %uld pid = %d\n", cause_code, p->pid);
+                proc_setkilled(p);
+                break;
+            }
             default:
                 printf("stval = %p\n", r_stval());
                 printf("Unknow User Exception! Code = %uld\n",cause_code);
@@ -0,0 +1,187 @@
+/*
+    ext4文件映射的回归测试
+    1. read()到PROT_READ的映射必须失败: 内核不能绕过PTE的权限写入
+       只读的文件映射直接指向页缓存, 写入会改掉文件内容
+       只读的匿名私有映射读过之后指向全局零页, 写入会影响所有进程
+       fork之后只读的私有页由父子进程共享(不带PTE_COW), 一方写入另一方也会看到
+    2. 覆盖写文件中间的内容不改变文件大小
+    全部通过输出PASS并以0退出, 否则输出FAIL和失败的检查项并以1退出
+*/
+#include "sys.h"
+
+#define AT_FDCWD      -100
+#define O_RDONLY      0x000
+#define O_RDWR        0x002
+#define O_CREAT       0x040
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+#define PAGE_SIZE     4096
+#define SIGCHLD       17
+
+#ifndef SYS_mprotect
+#define SYS_mprotect  226
+#endif
+
+#define TARGET "ext4_mmap_target"   // 被只读映射的文件
+#define SOURCE "ext4_mmap_source"   // read()的数据来源
+#define DATA   "0123456789abcdef"
+#define JUNK   "XXXXXXXXXXXXXXXX"
+#define LEN    16
+
+static int failed = 0;
+
+static int str_len(const char* s)
+{
+    int i;
+    for(i = 0; s[i] != '\0'; i++);
+    return i;
+}
+
+static void say(const char* s)
+{
+    syscall(SYS_write, 1, s, str_len(s));
+}
+
+static void check(int ok, const char* what)
+{
+    if(ok) return;
+    say("FAIL: ");
+    say(what);
+    say("\n");
+    failed = 1;
+}
+
+// 创建path, 内容为data[0, len)
+static int make_file(const char* path, const char* data, int len)
+{
+    int fd = syscall(SYS_openat, AT_FDCWD, path, O_CREAT | O_RDWR, 0666);
+    if(fd < 0) return -1;
+    int n = syscall(SYS_write, fd, data, len);
+    syscall(SYS_close, fd);
+    return n == len ? 0 : -1;
+}
+
+// path的全部内容是否正好是data[0, len)
+static int same_file(const char* path, const char* data, int len)
+{
+    char buf[64];
+    int fd = syscall(SYS_openat, AT_FDCWD, path, O_RDONLY, 0);
+    if(fd < 0) return 0;
+    int n = syscall(SYS_read, fd, buf, sizeof(buf));
+    syscall(SYS_close, fd);
+    if(n != len) return 0;
+    for(int i = 0; i < len; i++)
+        if(buf[i] != data[i]) return 0;
+    return 1;
+}
+
+// 从SOURCE读LEN字节到dst, 返回read()的返回值
+static long read_source(char* dst)
+{
+    int fd = syscall(SYS_openat, AT_FDCWD, SOURCE, O_RDONLY, 0);
+    if(fd < 0) return LEN; // 当作写入成功, 使检查失败
+    long n = syscall(SYS_read, fd, dst, LEN);
+    syscall(SYS_close, fd);
+    return n;
+}
+
+// 以O_RDONLY打开TARGET并只读映射, read()到映射上应当失败且文件不变
+static void test_file_map(int flags, const char* what)
+{
+    int fd = syscall(SYS_openat, AT_FDCWD, TARGET, O_RDONLY, 0);
+    check(fd >= 0, what);
+    if(fd < 0) return;
+
+    char* m = (char*)syscall(SYS_mmap, 0, PAGE_SIZE, PROT_READ, flags, fd, 0);
+    check(m != (char*)-1, what);
+    if(m != (char*)-1) {
+        check(m[0] == DATA[0], what);         // 先读一次, 映射上页缓存的页
+        check(read_source(m) <= 0, what);      // 内核不能写入只读映射
+        check(m[0] == DATA[0], what);
+        syscall(SYS_munmap, m, PAGE_SIZE);     // 共享映射在这里写回脏页
+    }
+    syscall(SYS_close, fd);
+    check(same_file(TARGET, DATA, LEN), what);
+}
+
+// 只读的匿名私有映射: 读过之后映射的是零页, read()到它上面应当失败
+static void test_zero_page(void)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char* a = (char*)syscall(SYS_mmap, 0, PAGE_SIZE, PROT_READ, flags, -1, 0);
+    check(a != (char*)-1, "anonymous PROT_READ mmap");
+    if(a == (char*)-1) return;
+
+    check(a[0] == 0, "anonymous page reads as zero");
+    check(read_source(a) <= 0, "read() into PROT_READ anonymous mapping");
+
+    // 新的匿名映射读到的仍然是0
+    char* b = (char*)syscall(SYS_mmap, 0, PAGE_SIZE, PROT_READ, flags, -1, 0);
+    check(b != (char*)-1 && b[0] == 0 && a[0] == 0, "zero page unchanged");
+    if(b != (char*)-1) syscall(SYS_munmap, b, PAGE_SIZE);
+    syscall(SYS_munmap, a, PAGE_SIZE);
+}
+
+// fork之后共享的只读私有页: 子进程read()到它上面应当失败, 父进程的数据不变
+static void test_fork_shared(void)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char* a = (char*)syscall(SYS_mmap, 0, PAGE_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    check(a != (char*)-1, "anonymous mmap for fork");
+    if(a == (char*)-1) return;
+    for(int i = 0; i < LEN; i++)
+        a[i] = DATA[i];
+    check(syscall(SYS_mprotect, a, PAGE_SIZE, PROT_READ) == 0, "mprotect PROT_READ");
+
+    int pid = syscall(SYS_clone, SIGCHLD, 0);
+    check(pid >= 0, "fork");
+    if(pid == 0) {
+        int ok = read_source(a) <= 0 && a[0] == DATA[0];
+        syscall(SYS_exit, ok ? 0 : 1);
+    }
+    if(pid > 0) {
+        int status = -1;
+        syscall(SYS_wait4, pid, &status, 0, 0);
+        check(((status >> 8) & 0xff) == 0, "read() into shared read-only page in child");
+    }
+    for(int i = 0; i < LEN; i++)
+        if(a[i] != DATA[i]) {
+            check(0, "parent page unchanged after child read()");
+            break;
+        }
+    syscall(SYS_munmap, a, PAGE_SIZE);
+}
+
+// 覆盖写文件开头的两个字节, 大小不变
+static void test_overwrite_size(void)
+{
+    check(make_file(TARGET, DATA, LEN) == 0, "create file for overwrite");
+    int fd = syscall(SYS_openat, AT_FDCWD, TARGET, O_RDWR, 0);
+    check(fd >= 0, "open file for overwrite");
+    if(fd < 0) return;
+    check(syscall(SYS_write, fd, "ab", 2) == 2, "overwrite 2 bytes");
+    syscall(SYS_close, fd);
+    check(same_file(TARGET, "ab23456789abcdef", LEN), "overwrite keeps file size");
+}
+
+int main(void)
+{
+    check(make_file(TARGET, DATA, LEN) == 0, "create " TARGET);
+    check(make_file(SOURCE, JUNK, LEN) == 0, "create " SOURCE);
+
+    test_file_map(MAP_PRIVATE, "read() into PROT_READ MAP_PRIVATE file mapping");
+    test_file_map(MAP_SHARED, "read() into PROT_READ MAP_SHARED file mapping");
+    test_zero_page();
+    test_fork_shared();
+    test_overwrite_size();
+
+    syscall(SYS_unlinkat, AT_FDCWD, TARGET, 0);
+    syscall(SYS_unlinkat, AT_FDCWD, SOURCE, 0);
+
+    say(failed ? "ext4_mmap_test: FAIL\n" : "ext4_mmap_test: PASS\n");
+    syscall(SYS_exit, failed);
+    return failed;
+}